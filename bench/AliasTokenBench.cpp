@@ -0,0 +1,670 @@
+#include "AliasSet.h"
+#include "AliasToken.h"
+#include "TokenSnapshot.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/ErrorHandling.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "atomic"
+#include "chrono"
+#include "cstdlib"
+#include "map"
+#include "new"
+#include "random"
+#include "set"
+#include "sys/resource.h"
+#include "thread"
+
+using namespace llvm;
+using namespace AliasUtil;
+
+// Every heap allocation made by the process is counted so that benchmarks can
+// report allocations per operation, thread pool workers allocate too
+static std::atomic<size_t> Allocations(0);
+
+void* operator new(std::size_t Size) {
+    Allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* Ptr = std::malloc(Size ? Size : 1)) return Ptr;
+    report_bad_alloc_error("Benchmark allocation failed");
+}
+
+void operator delete(void* Ptr) noexcept { std::free(Ptr); }
+void operator delete(void* Ptr, std::size_t) noexcept { std::free(Ptr); }
+
+namespace {
+
+cl::OptionCategory BenchCategory("AliasTokenBench options");
+
+cl::opt<unsigned> NumFunctions("functions", cl::init(1000),
+                               cl::desc("Functions in the generated module"),
+                               cl::cat(BenchCategory));
+cl::opt<unsigned> InstsPerFunction(
+    "insts", cl::init(64),
+    cl::desc("Statements generated in each function"),
+    cl::cat(BenchCategory));
+cl::opt<unsigned> StructDepth(
+    "struct-depth", cl::init(3),
+    cl::desc("Nesting depth of the struct accessed through GEPs"),
+    cl::cat(BenchCategory));
+cl::opt<unsigned> NumGlobals("globals", cl::init(64),
+                             cl::desc("Pointer global variables"),
+                             cl::cat(BenchCategory));
+cl::opt<double> CallDensity(
+    "call-density", cl::init(0.05),
+    cl::desc("Fraction of statements which are calls, between 0 and 1"),
+    cl::cat(BenchCategory));
+cl::opt<unsigned> Rounds("rounds", cl::init(10),
+                         cl::desc("Repetitions of the warm benchmarks"),
+                         cl::cat(BenchCategory));
+cl::opt<unsigned> MaxThreads(
+    "max-threads", cl::init(0),
+    cl::desc("Largest thread count of the concurrent benchmarks, 0 uses "
+             "every core"),
+    cl::cat(BenchCategory));
+cl::opt<unsigned> Seed("seed", cl::init(1),
+                       cl::desc("Seed of the module generator"),
+                       cl::cat(BenchCategory));
+
+/// buildModule - Creates a module of NumFunctions functions of
+/// InstsPerFunction statements each, similar to C++ code at -O0. Statements
+/// are stores and loads through pointer slots, GEPs into a struct nested
+/// StructDepth times, casts, accesses to NumGlobals globals and, for a
+/// CallDensity fraction of them, calls to other functions or operator new
+std::unique_ptr<Module> buildModule(LLVMContext& Ctx) {
+    auto M = std::make_unique<Module>("bench", Ctx);
+    std::mt19937 Rng(Seed);
+    std::uniform_real_distribution<double> Coin(0, 1);
+    auto pick = [&Rng](size_t N) { return size_t(Rng() % N); };
+
+    Type* I32 = Type::getInt32Ty(Ctx);
+    PointerType* PtrTy = PointerType::getUnqual(I32);
+    Type* BytePtrTy = Type::getInt8PtrTy(Ctx);
+    StructType* Outer = StructType::create(Ctx, {PtrTy, PtrTy}, "struct.S0");
+    for (unsigned D = 1; D <= StructDepth; ++D)
+        Outer = StructType::create(Ctx, {PtrTy, Outer},
+                                   ("struct.S" + Twine(D)).str());
+
+    std::vector<GlobalVariable*> Globals;
+    for (unsigned G = 0; G < NumGlobals; ++G)
+        Globals.push_back(new GlobalVariable(
+            *M, PtrTy, false, GlobalValue::ExternalLinkage,
+            ConstantPointerNull::get(PtrTy), "g" + Twine(G)));
+
+    FunctionCallee New =
+        M->getOrInsertFunction("_Znwm", BytePtrTy, Type::getInt64Ty(Ctx));
+    FunctionType* FTy = FunctionType::get(PtrTy, {PtrTy}, false);
+    std::vector<Function*> Funcs;
+    for (unsigned F = 0; F < NumFunctions; ++F)
+        Funcs.push_back(Function::Create(FTy, GlobalValue::ExternalLinkage,
+                                         "f" + Twine(F), M.get()));
+
+    for (Function* Func : Funcs) {
+        IRBuilder<> Builder(BasicBlock::Create(Ctx, "entry", Func));
+        std::vector<Value*> Ptrs = {Builder.CreateAlloca(I32, nullptr, "t"),
+                                    Func->getArg(0)};
+        std::vector<Value*> Slots;
+        for (unsigned S = 0; S < 4; ++S)
+            Slots.push_back(Builder.CreateAlloca(PtrTy, nullptr, "s"));
+        Value* Obj = Builder.CreateAlloca(Outer, nullptr, "obj");
+
+        for (unsigned I = 0; I < InstsPerFunction; ++I) {
+            if (Coin(Rng) < CallDensity) {
+                if (pick(2)) {
+                    Ptrs.push_back(Builder.CreateCall(
+                        Funcs[pick(Funcs.size())], {Ptrs[pick(Ptrs.size())]},
+                        "r"));
+                } else {
+                    Value* Mem = Builder.CreateCall(New, Builder.getInt64(4));
+                    Ptrs.push_back(Builder.CreateBitCast(Mem, PtrTy, "n"));
+                }
+                continue;
+            }
+            switch (pick(NumGlobals ? 6 : 4)) {
+                case 0:
+                    Builder.CreateStore(Ptrs[pick(Ptrs.size())],
+                                        Slots[pick(Slots.size())]);
+                    break;
+                case 1:
+                    Ptrs.push_back(Builder.CreateLoad(
+                        PtrTy, Slots[pick(Slots.size())], "l"));
+                    break;
+                case 2: {
+                    // obj.1.1...1.0 reaches a pointer field at any depth
+                    SmallVector<Value*, 8> Indices = {Builder.getInt32(0)};
+                    for (size_t D = pick(StructDepth + 1); D > 0; --D)
+                        Indices.push_back(Builder.getInt32(1));
+                    Indices.push_back(Builder.getInt32(0));
+                    Slots.push_back(
+                        Builder.CreateInBoundsGEP(Outer, Obj, Indices, "f"));
+                    break;
+                }
+                case 3: {
+                    Value* Raw = Builder.CreateBitCast(Ptrs[pick(Ptrs.size())],
+                                                       BytePtrTy, "b");
+                    Ptrs.push_back(Builder.CreateBitCast(Raw, PtrTy, "c"));
+                    break;
+                }
+                case 4:
+                    Builder.CreateStore(Ptrs[pick(Ptrs.size())],
+                                        Globals[pick(Globals.size())]);
+                    break;
+                case 5:
+                    Ptrs.push_back(Builder.CreateLoad(
+                        PtrTy, Globals[pick(Globals.size())], "gl"));
+                    break;
+            }
+        }
+        Builder.CreateRet(Ptrs.back());
+    }
+    return M;
+}
+
+double nsSince(std::chrono::steady_clock::time_point Start, size_t Ops) {
+    auto Elapsed = std::chrono::steady_clock::now() - Start;
+    return std::chrono::duration<double, std::nano>(Elapsed).count() / Ops;
+}
+
+/// report - Prints the time per operation, the throughput and the allocations
+/// per operation of a benchmark of \p Ops operations
+void report(StringRef Name, std::chrono::steady_clock::time_point Start,
+            size_t Ops, size_t AllocationsBefore) {
+    double NsPerOp = nsSince(Start, Ops);
+    outs() << Name << ": " << format("%.2f", NsPerOp) << " ns/op, "
+           << format("%.0f", 1e9 / NsPerOp) << " ops/s, "
+           << format("%.3f", double(Allocations - AllocationsBefore) / Ops)
+           << " allocations/op\n";
+}
+
+std::vector<Instruction*> getInstructions(Module& M) {
+    std::vector<Instruction*> Insts;
+    for (Function& F : M)
+        for (Instruction& I : instructions(F)) Insts.push_back(&I);
+    return Insts;
+}
+
+/// benchLookup - Measures getAliasToken on values missing from a new bank,
+/// which creates a token for each, and on values already in the bank
+void benchLookup(Module& M) {
+    std::vector<Value*> Values;
+    for (GlobalVariable& G : M.globals()) Values.push_back(&G);
+    for (Function& F : M) {
+        for (Argument& Arg : F.args()) Values.push_back(&Arg);
+        for (Instruction& I : instructions(F)) Values.push_back(&I);
+    }
+
+    size_t Before = Allocations;
+    auto Start = std::chrono::steady_clock::now();
+    for (unsigned R = 0; R < Rounds; ++R) {
+        AliasTokens AT;
+        for (Value* V : Values) AT.getAliasToken(V);
+    }
+    report("getAliasToken(miss)", Start, Values.size() * Rounds, Before);
+
+    AliasTokens AT;
+    for (Value* V : Values) AT.getAliasToken(V);
+    Before = Allocations;
+    Start = std::chrono::steady_clock::now();
+    for (unsigned R = 0; R < Rounds; ++R)
+        for (Value* V : Values) AT.getAliasToken(V);
+    report("getAliasToken(hit)", Start, Values.size() * Rounds, Before);
+}
+
+/// benchExtractByOpcode - Measures extractAliasToken on a warm bank for each
+/// class of instruction in \p M
+void benchExtractByOpcode(Module& M) {
+    AliasTokens AT;
+    std::map<unsigned, std::vector<Instruction*>> ByOpcode;
+    for (Instruction* I : getInstructions(M)) {
+        ByOpcode[I->getOpcode()].push_back(I);
+        AT.extractAliasToken(I);
+    }
+    for (auto& Class : ByOpcode) {
+        size_t Before = Allocations;
+        auto Start = std::chrono::steady_clock::now();
+        for (unsigned R = 0; R < Rounds; ++R)
+            for (Instruction* I : Class.second) AT.extractAliasToken(I);
+        report(("extractAliasToken(" +
+                Twine(Instruction::getOpcodeName(Class.first)) + ")")
+                   .str(),
+               Start, Class.second.size() * Rounds, Before);
+    }
+}
+
+/// benchExtractionCache - Measures repeated extraction of every instruction
+/// with and without the extraction cache
+void benchExtractionCache(Module& M) {
+    AliasTokens AT;
+    std::vector<Instruction*> Insts = getInstructions(M);
+    for (Instruction* I : Insts) (void)AT.extractCachedAliasToken(I);
+    size_t Ops = Insts.size() * Rounds;
+
+    size_t Before = Allocations;
+    auto Start = std::chrono::steady_clock::now();
+    for (unsigned R = 0; R < Rounds; ++R)
+        for (Instruction* I : Insts) AT.extractTokens(I);
+    report("extractTokens(warm)", Start, Ops, Before);
+
+    Before = Allocations;
+    Start = std::chrono::steady_clock::now();
+    for (unsigned R = 0; R < Rounds; ++R)
+        for (Instruction* I : Insts) (void)AT.extractCachedAliasToken(I);
+    report("extractCachedAliasToken(warm)", Start, Ops, Before);
+}
+
+/// benchFieldTokens - Measures handleGEPUtil on every GEP of \p M, the field
+/// paths are as deep as the generated struct
+void benchFieldTokens(Module& M) {
+    AliasTokens AT;
+    std::vector<GetElementPtrInst*> GEPs;
+    for (Instruction* I : getInstructions(M))
+        if (GetElementPtrInst* GEP = dyn_cast<GetElementPtrInst>(I))
+            GEPs.push_back(GEP);
+    if (GEPs.empty()) return;
+
+    size_t Before = Allocations;
+    auto Start = std::chrono::steady_clock::now();
+    for (unsigned R = 0; R < Rounds; ++R)
+        for (GetElementPtrInst* GEP : GEPs)
+            AT.handleGEPUtil(GEP,
+                             AT.getAliasToken(GEP->getPointerOperand()));
+    report("handleGEPUtil", Start, GEPs.size() * Rounds, Before);
+}
+
+/// benchStatementType - Measures extractStatementType over every instruction
+void benchStatementType(Module& M) {
+    AliasTokens AT;
+    std::vector<Instruction*> Insts = getInstructions(M);
+    int Levels = 0;
+    size_t Before = Allocations;
+    auto Start = std::chrono::steady_clock::now();
+    for (unsigned R = 0; R < Rounds; ++R)
+        for (Instruction* I : Insts) Levels += AT.extractStatementType(I).first;
+    report("extractStatementType", Start, Insts.size() * Rounds, Before);
+    if (!Levels) outs() << "extractStatementType returned no level\n";
+}
+
+/// benchModule - Tokenizes \p M with extractModule on 1 to \p Threads threads
+/// and measures the teardown of the filled bank
+void benchModule(Module& M, unsigned Threads) {
+    size_t NumInsts = M.getInstructionCount();
+    for (unsigned T = 1; T <= Threads; T *= 2) {
+        std::unique_ptr<AliasTokens> AT(
+            new AliasTokens(BankFlags::Concurrent));
+        auto Start = std::chrono::steady_clock::now();
+        ModuleTokens MT = AT->extractModule(M, T);
+        double Ns = nsSince(Start, NumInsts) * NumInsts;
+        outs() << "extractModule, " << T << " threads: "
+               << format("%.2f", Ns / NumInsts) << " ns/inst, "
+               << format("%.0f", AT->size() * 1e9 / Ns) << " tokens/s\n";
+
+        size_t Tokens = AT->size();
+        Start = std::chrono::steady_clock::now();
+        AT.reset();
+        outs() << "  teardown: " << format("%.2f", nsSince(Start, Tokens))
+               << " ns/token\n";
+    }
+}
+
+/// benchConcurrent - Tokenizes \p M on a concurrent bank with 1 to
+/// \p Threads threads, functions are distributed round robin
+void benchConcurrent(Module& M, unsigned Threads) {
+    std::vector<Function*> Funcs;
+    for (Function& F : M) Funcs.push_back(&F);
+    size_t NumInsts = M.getInstructionCount();
+    double Base = 0;
+    for (unsigned T = 1; T <= Threads; T *= 2) {
+        AliasTokens AT(BankFlags::Concurrent);
+        auto Start = std::chrono::steady_clock::now();
+        std::vector<std::thread> Workers;
+        for (unsigned W = 0; W < T; ++W) {
+            Workers.emplace_back([&AT, &Funcs, W, T]() {
+                for (size_t F = W; F < Funcs.size(); F += T)
+                    for (Instruction& I : instructions(Funcs[F]))
+                        AT.extractTokens(&I);
+            });
+        }
+        for (std::thread& Worker : Workers) Worker.join();
+        double NsPerOp = nsSince(Start, NumInsts);
+        if (T == 1) Base = NsPerOp;
+        outs() << "concurrent extractTokens, " << T << " threads: "
+               << format("%.2f", NsPerOp) << " ns/inst, "
+               << format("%.2fx", Base / NsPerOp) << "\n";
+    }
+}
+
+/// benchMerge - Tokenizes the functions of \p M in one bank per part, like
+/// separately built modules, and merges the parts with up to \p Threads
+/// threads against tokenizing \p M again in a single bank
+void benchMerge(Module& M, unsigned Threads) {
+    const unsigned NumParts = 8;
+    std::vector<std::unique_ptr<AliasTokens>> Parts;
+    std::vector<AliasTokens*> Banks;
+    for (unsigned P = 0; P < NumParts; ++P) {
+        Parts.emplace_back(new AliasTokens());
+        Banks.push_back(Parts.back().get());
+    }
+    unsigned Index = 0;
+    size_t NumTokens = 0;
+    for (Function& F : M) {
+        AliasTokens& Part = *Parts[Index++ % NumParts];
+        for (Argument& Arg : F.args()) Part.extractTokens(&Arg, &F);
+        for (Instruction& I : instructions(F)) Part.extractTokens(&I);
+    }
+    for (AliasTokens* Bank : Banks) NumTokens += Bank->size();
+
+    auto Start = std::chrono::steady_clock::now();
+    AliasTokens Whole;
+    for (Function& F : M) {
+        for (Argument& Arg : F.args()) Whole.extractTokens(&Arg, &F);
+        for (Instruction& I : instructions(F)) Whole.extractTokens(&I);
+    }
+    double WholeNs = nsSince(Start, Whole.size());
+    for (unsigned T = 1; T <= Threads; T *= 2) {
+        AliasTokens Merged(BankFlags::Concurrent);
+        Start = std::chrono::steady_clock::now();
+        Merged.merge(Banks, T);
+        outs() << "merge, " << T << " threads: "
+               << format("%.2f", nsSince(Start, NumTokens))
+               << " ns/token, retokenizing " << format("%.2f", WholeNs)
+               << " ns/token\n";
+    }
+}
+
+/// benchCallBindings - Compares walking the bindings of the call sites of
+/// \p M from a table built once with deriving them with getAliasToken in
+/// every round
+void benchCallBindings(Module& M) {
+    AliasTokens AT;
+    auto Start = std::chrono::steady_clock::now();
+    CallBindings Bindings = AT.bindCalls(M);
+    double BuildNs = nsSince(Start, 1);
+    size_t Ops = 0;
+    for (const CallBindings::Site& S : Bindings.sites())
+        Ops += Bindings.getArguments(S).size();
+    if (!Ops) return;
+
+    // Keeps the loops from being optimized away
+    volatile uint32_t Sink = 0;
+    Start = std::chrono::steady_clock::now();
+    for (unsigned R = 0; R < Rounds; ++R)
+        for (const CallBindings::Site& S : Bindings.sites())
+            for (const CallBindings::Binding& B : Bindings.getArguments(S))
+                Sink += B.Source->getID() ^ B.Target->getID();
+    double TableNs = nsSince(Start, Ops * Rounds);
+    Start = std::chrono::steady_clock::now();
+    for (unsigned R = 0; R < Rounds; ++R)
+        for (const CallBindings::Site& S : Bindings.sites())
+            for (unsigned I = 0; I < S.Callee->arg_size(); ++I) {
+                Value* Actual = S.Call->getArgOperand(I);
+                if (isa<ConstantData>(Actual)) continue;
+                Sink += AT.getAliasToken(Actual)->getID() ^
+                        AT.getAliasToken(S.Callee->getArg(I))->getID();
+            }
+    double ManualNs = nsSince(Start, Ops * Rounds);
+    outs() << "bindCalls: " << Bindings.size() << " sites, build "
+           << format("%.3f", BuildNs / 1e6) << " ms, table "
+           << format("%.2f", TableNs) << " ns/binding, getAliasToken "
+           << format("%.2f", ManualNs) << " ns/binding\n";
+}
+
+/// benchAliasSet - Compares union, intersection and difference of AliasSet
+/// with std::set<Alias*> on random sets of tokens of \p M of several sizes
+void benchAliasSet(Module& M) {
+    AliasTokens AT;
+    for (Instruction* I : getInstructions(M)) AT.extractTokens(I);
+    std::vector<Alias*> Tokens(AT.tokens().begin(), AT.tokens().end());
+    std::mt19937 Rng(Seed);
+    std::uniform_int_distribution<size_t> Pick(0, Tokens.size() - 1);
+    const unsigned NumPairs = 64;
+    // Keeps the loops from being optimized away
+    volatile size_t Sink = 0;
+    for (size_t Size : {4, 16, 64, 512, 4096}) {
+        if (Size > Tokens.size()) break;
+        std::vector<AliasSet> Sets;
+        std::vector<std::set<Alias*>> Refs;
+        for (unsigned I = 0; I < 2 * NumPairs; ++I) {
+            Sets.emplace_back(AT);
+            Refs.emplace_back();
+            while (Refs.back().size() < Size) {
+                Alias* A = Tokens[Pick(Rng)];
+                Sets.back().insert(A);
+                Refs.back().insert(A);
+            }
+        }
+        size_t Ops = NumPairs * Rounds;
+        double SetNs[3], RefNs[3];
+        for (unsigned Op = 0; Op < 3; ++Op) {
+            auto Start = std::chrono::steady_clock::now();
+            for (unsigned R = 0; R < Rounds; ++R)
+                for (unsigned I = 0; I < NumPairs; ++I) {
+                    AliasSet Result = Sets[2 * I];
+                    if (Op == 0) Result.unionWith(Sets[2 * I + 1]);
+                    if (Op == 1) Result.intersectWith(Sets[2 * I + 1]);
+                    if (Op == 2) Result.subtract(Sets[2 * I + 1]);
+                    Sink += Result.size();
+                }
+            SetNs[Op] = nsSince(Start, Ops);
+            Start = std::chrono::steady_clock::now();
+            for (unsigned R = 0; R < Rounds; ++R)
+                for (unsigned I = 0; I < NumPairs; ++I) {
+                    const std::set<Alias*>& LHS = Refs[2 * I];
+                    const std::set<Alias*>& RHS = Refs[2 * I + 1];
+                    std::set<Alias*> Result;
+                    auto Out = std::inserter(Result, Result.end());
+                    if (Op == 0)
+                        std::set_union(LHS.begin(), LHS.end(), RHS.begin(),
+                                       RHS.end(), Out);
+                    if (Op == 1)
+                        std::set_intersection(LHS.begin(), LHS.end(),
+                                              RHS.begin(), RHS.end(), Out);
+                    if (Op == 2)
+                        std::set_difference(LHS.begin(), LHS.end(),
+                                            RHS.begin(), RHS.end(), Out);
+                    Sink += Result.size();
+                }
+            RefNs[Op] = nsSince(Start, Ops);
+        }
+        outs() << "AliasSet, " << Size << " tokens: union "
+               << format("%.1f", SetNs[0]) << " ns vs "
+               << format("%.1f", RefNs[0]) << " ns std::set, intersection "
+               << format("%.1f", SetNs[1]) << " ns vs "
+               << format("%.1f", RefNs[1]) << " ns, difference "
+               << format("%.1f", SetNs[2]) << " ns vs "
+               << format("%.1f", RefNs[2]) << " ns\n";
+    }
+}
+
+/// benchMemory - Reports the memory held by the bank per token after
+/// tokenizing every instruction of \p M
+void benchMemory(Module& M) {
+    AliasTokens AT;
+    for (Instruction* I : getInstructions(M)) AT.extractTokens(I);
+    outs() << "memory: " << AT.size() << " tokens, " << sizeof(Alias)
+           << " bytes/Alias, "
+           << format("%.1f", double(AT.getMemoryUsage()) / AT.size())
+           << " bytes/token including indices\n";
+}
+
+/// benchReleaseFunction - Tokenizes \p M function by function on a function
+/// scoped bank releasing each function after it, and reports the largest
+/// memory held by the bank against a bank keeping every function
+void benchReleaseFunction(Module& M) {
+    AliasTokens Scoped(BankFlags::FunctionScoped);
+    size_t PeakBytes = 0;
+    auto Start = std::chrono::steady_clock::now();
+    for (Function& F : M) {
+        for (Instruction& I : instructions(F)) Scoped.extractTokens(&I);
+        PeakBytes = std::max(PeakBytes, Scoped.getMemoryUsage());
+        Scoped.releaseFunction(&F);
+    }
+    double NsPerInst = nsSince(Start, M.getInstructionCount());
+
+    AliasTokens Whole;
+    for (Function& F : M)
+        for (Instruction& I : instructions(F)) Whole.extractTokens(&I);
+    outs() << "releaseFunction: " << format("%.2f", NsPerInst)
+           << " ns/inst, peak bank " << PeakBytes / 1024 << " KiB, whole bank "
+           << Whole.getMemoryUsage() / 1024 << " KiB\n";
+}
+
+/// benchTracking - Compares tokenizing \p M with a bank watching the values
+/// of its tokens against a plain bank
+void benchTracking(Module& M) {
+    std::vector<Instruction*> Insts = getInstructions(M);
+    auto Start = std::chrono::steady_clock::now();
+    AliasTokens Plain;
+    for (Instruction* I : Insts) Plain.extractTokens(I);
+    double PlainNs = nsSince(Start, Insts.size());
+
+    Start = std::chrono::steady_clock::now();
+    std::unique_ptr<AliasTokens> Tracked(new AliasTokens(BankFlags::Tracking));
+    for (Instruction* I : Insts) Tracked->extractTokens(I);
+    double TrackedNs = nsSince(Start, Insts.size());
+    size_t TrackedBytes = Tracked->getMemoryUsage();
+    Start = std::chrono::steady_clock::now();
+    Tracked.reset();
+    double TeardownNs = nsSince(Start, 1);
+
+    outs() << "tracking: " << format("%.2f", TrackedNs) << " ns/inst vs "
+           << format("%.2f", PlainNs) << " ns/inst untracked, bank "
+           << TrackedBytes / 1024 << " KiB vs "
+           << Plain.getMemoryUsage() / 1024 << " KiB, teardown "
+           << format("%.3f", TeardownNs / 1e6) << " ms\n";
+}
+
+/// benchSnapshot - Compares tokenizing \p M from scratch with mapping a
+/// snapshot of the tokens and binding every token back to \p M
+void benchSnapshot(Module& M) {
+    SmallString<128> Path;
+    if (sys::fs::createTemporaryFile("aliastokens", "snapshot", Path)) {
+        outs() << "snapshot: can not create a temporary file\n";
+        return;
+    }
+    size_t NumInsts = M.getInstructionCount();
+
+    auto Start = std::chrono::steady_clock::now();
+    AliasTokens Cold;
+    for (Instruction* I : getInstructions(M)) Cold.extractTokens(I);
+    double ColdNs = nsSince(Start, 1);
+    size_t NumTokens = Cold.size();
+    Start = std::chrono::steady_clock::now();
+    {
+        std::error_code EC;
+        raw_fd_ostream OS(Path, EC);
+        Cold.serialize(OS, M);
+    }
+    double SerializeNs = nsSince(Start, 1);
+    uint64_t Bytes = 0;
+    sys::fs::file_size(Path, Bytes);
+
+    AliasTokens Warm;
+    Start = std::chrono::steady_clock::now();
+    auto Snapshot = TokenSnapshot::open(Path, M, Warm);
+    double OpenNs = nsSince(Start, 1);
+    if (!Snapshot) {
+        outs() << "snapshot: " << toString(Snapshot.takeError()) << "\n";
+        return;
+    }
+    Start = std::chrono::steady_clock::now();
+    for (uint32_t ID = 0; ID < (*Snapshot)->size(); ++ID)
+        (*Snapshot)->getToken(ID);
+    double BindNs = nsSince(Start, 1);
+    sys::fs::remove(Path);
+
+    outs() << "snapshot: cold " << format("%.2f", ColdNs / NumInsts)
+           << " ns/inst, serialize " << format("%.2f", SerializeNs / NumTokens)
+           << " ns/token, " << format("%.1f", double(Bytes) / NumTokens)
+           << " bytes/token, warm open " << format("%.3f", OpenNs / 1e6)
+           << " ms, bind " << format("%.2f", BindNs / NumTokens)
+           << " ns/token\n";
+}
+
+/// benchHeap - Measures extraction of \p M and the heap tokens of its
+/// allocations under each heap abstraction, the allocations of a function
+/// are requested in the context of each of its call sites for call strings,
+/// and with the number of heap tokens capped to half of them
+void benchHeap(Module& M) {
+    std::vector<Instruction*> Insts = getInstructions(M);
+    // Allocations cast to their type and the calls of their function
+    std::vector<std::pair<BitCastInst*, std::vector<CallBase*>>> Casts;
+    for (Instruction* I : Insts) {
+        BitCastInst* Cast = dyn_cast<BitCastInst>(I);
+        if (!Cast) continue;
+        CallBase* Site = dyn_cast<CallBase>(Cast->getOperand(0));
+        if (!Site || !AliasTokens::isAllocation(Site)) continue;
+        std::vector<CallBase*> Calls;
+        for (User* U : I->getFunction()->users())
+            if (CallBase* Call = dyn_cast<CallBase>(U)) Calls.push_back(Call);
+        Casts.push_back({Cast, std::move(Calls)});
+    }
+    auto run = [&](StringRef Name, HeapAbstraction Mode, size_t MaxTokens) {
+        auto Start = std::chrono::steady_clock::now();
+        AliasTokens AT;
+        AT.setHeapAbstraction(Mode, 1, MaxTokens);
+        for (Instruction* I : Insts) AT.extractTokens(I);
+        for (auto& Cast : Casts)
+            for (CallBase* Call : Cast.second)
+                AT.getHeapToken(cast<CallBase>(Cast.first->getOperand(0)),
+                                Cast.first->getDestTy(), {Call});
+        double Ns = nsSince(Start, Insts.size());
+        size_t NumHeap = 0;
+        for (Alias* A : AT.tokens()) NumHeap += A->isMem();
+        outs() << "heap(" << Name << "): " << format("%.2f", Ns)
+               << " ns/inst, " << NumHeap << " heap tokens, " << AT.size()
+               << " tokens\n";
+        return NumHeap;
+    };
+    run("type", HeapAbstraction::Type, 0);
+    run("site", HeapAbstraction::Site, 0);
+    size_t NumHeap = run("callstring", HeapAbstraction::CallString, 0);
+    run("callstring,capped", HeapAbstraction::CallString, NumHeap / 2);
+}
+
+/// getPeakRSS - Returns the peak resident set size of the process in KiB
+long getPeakRSS() {
+    struct rusage Usage;
+    getrusage(RUSAGE_SELF, &Usage);
+    return Usage.ru_maxrss;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    cl::HideUnrelatedOptions(BenchCategory);
+    cl::ParseCommandLineOptions(argc, argv, "AliasToken benchmarks\n");
+    unsigned Threads = MaxThreads;
+    if (!Threads) Threads = std::max(1u, std::thread::hardware_concurrency());
+
+    LLVMContext Ctx;
+    auto Start = std::chrono::steady_clock::now();
+    auto M = buildModule(Ctx);
+    outs() << "module: " << NumFunctions << " functions, "
+           << M->getInstructionCount() << " instructions, " << NumGlobals
+           << " globals, struct depth " << StructDepth << ", built in "
+           << format("%.1f", nsSince(Start, 1) / 1e6) << " ms, peak RSS "
+           << getPeakRSS() << " KiB\n";
+
+    benchLookup(*M);
+    benchExtractByOpcode(*M);
+    benchExtractionCache(*M);
+    benchFieldTokens(*M);
+    benchStatementType(*M);
+    benchMemory(*M);
+    benchReleaseFunction(*M);
+    benchTracking(*M);
+    benchCallBindings(*M);
+    benchAliasSet(*M);
+    benchHeap(*M);
+    benchSnapshot(*M);
+    benchConcurrent(*M, Threads);
+    benchModule(*M, Threads);
+    benchMerge(*M, Threads);
+    outs() << "peak RSS: " << getPeakRSS() << " KiB\n";
+    return 0;
+}
@@ -1,6 +1,8 @@
 #ifndef ALIAS_H
 #define ALIAS_H
 
+#include "llvm/ADT/DenseMapInfo.h"
+#include "llvm/ADT/Hashing.h"
 #include "llvm/ADT/StringRef.h"
 #include "llvm/IR/Argument.h"
 #include "llvm/IR/Function.h"
@@ -9,53 +11,150 @@
 #include "llvm/IR/Operator.h"
 #include "llvm/IR/Type.h"
 #include "llvm/IR/Value.h"
+#include "cstdint"
+#include "ostream"
 #include "string"
+#include "type_traits"
 
 namespace AliasUtil {
 
-class Alias {
+/// AliasKind - The entity an alias token is derived from, an Orig token is
+/// the location allocated for its base token and a Heap token the objects
+/// allocated at an allocation site, in a calling context
+enum class AliasKind : uint8_t {
+    Value = 0,
+    Type = 1,
+    Argument = 2,
+    Dummy = 3,
+    Orig = 4,
+    Heap = 5
+};
+
+/// FieldPath - A node in the trie of field paths owned by an AliasTokens bank.
+/// Each node extends its parent path by one GEP index; paths are unique per
+/// bank so they are compared by pointer. The empty path is nullptr
+class FieldPath {
+   private:
+    const FieldPath* Parent;
+    int64_t Index;
+    unsigned Depth;
+
+   public:
+    // Index of a GEP operand which is not a constant
+    static constexpr int64_t Variable = INT64_MIN;
+
+    FieldPath(const FieldPath* Parent, int64_t Index);
+
+    const FieldPath* getParent() const;
+    int64_t getIndex() const;
+    unsigned getDepth() const;
+    bool isVariable() const;
+};
+
+/// HeapContext - A node in the trie of allocation contexts owned by an
+/// AliasTokens bank. The root of a path is an allocation site and each node
+/// extends its parent by a call site leading to it, innermost call first;
+/// paths are unique per bank so they are compared by pointer
+class HeapContext {
    private:
-    llvm::Value* Val;
+    const HeapContext* Parent;
+    llvm::Instruction* Site;
+    // Type of the allocated objects, only set on the root
     llvm::Type* Ty;
-    llvm::Argument* Arg;
-    // 0 is Value
-    // 1 is Type
-    // 2 is Argument
-    // 3 is Dummy
-    std::string Index;
-    unsigned int Kind;
-    llvm::Function* Func;
-    std::string name;
+    unsigned Depth;
+
+   public:
+    HeapContext(const HeapContext* Parent, llvm::Instruction* Site,
+                llvm::Type* Ty);
+
+    const HeapContext* getParent() const;
+    llvm::Instruction* getSite() const;
+    const HeapContext* getAllocation() const;
+    llvm::Type* getType() const;
+    unsigned getDepth() const;
+};
+
+/// AliasKey - Structural identity of an alias token, used by AliasTokens to
+/// index its bank without building strings. Ptr is the underlying Value, Type
+/// or Argument, the interned name id for dummy tokens, the base of orig tokens
+/// or the allocation context of heap tokens; Field is the node of the field
+/// path of the token in the bank's trie.
+struct AliasKey {
+    const void* Ptr;
+    const llvm::Function* Func;
+    const FieldPath* Field;
+    AliasKind Kind;
+
+    bool operator==(const AliasKey& Other) const {
+        return Ptr == Other.Ptr && Func == Other.Func &&
+               Field == Other.Field && Kind == Other.Kind;
+    }
+};
+
+class AliasTokens;
+
+class Alias {
+   private:
+    friend class AliasTokens;
+
+    // Only the member selected by Kind is live, dummy tokens store the id of
+    // their interned name, orig tokens their base token and heap tokens their
+    // allocation context
+    union {
+        llvm::Value* Val;
+        llvm::Type* Ty;
+        llvm::Argument* Arg;
+        uintptr_t NameId;
+        const Alias* Base;
+        const HeapContext* Heap;
+    };
+    llvm::Function* Func = nullptr;
+    const FieldPath* Field = nullptr;
+    // Dense id assigned by the bank, InvalidID for tokens outside a bank
+    uint32_t ID = InvalidID;
+    AliasKind Kind;
     bool IsGlobal;
 
-    void set(llvm::Value* Val, unsigned int Kind, std::string Index,
+    void set(llvm::Value* Val, AliasKind Kind, const FieldPath* Field,
              llvm::Function* Func, bool Global = false);
-    void set(llvm::Type* Ty, unsigned int Kind, std::string Index);
-    void set(llvm::Argument* Arg, unsigned int Kind, std::string Index,
+    void set(llvm::Type* Ty, AliasKind Kind, const FieldPath* Field);
+    void set(llvm::Argument* Arg, AliasKind Kind, const FieldPath* Field,
+             llvm::Function* Func);
+    void set(uintptr_t NameId, AliasKind Kind, const FieldPath* Field,
              llvm::Function* Func);
-    void set(std::string S, unsigned int Kind, std::string Index,
+    void set(const Alias* Base, AliasKind Kind, const FieldPath* Field,
              llvm::Function* Func);
+    void set(const HeapContext* Heap, AliasKind Kind, const FieldPath* Field);
+    const void* entity() const;
+
+    static uintptr_t internName(llvm::StringRef Name);
 
    public:
-    void setIndex(llvm::GetElementPtrInst* GEPInst);
-    void setIndex(llvm::GEPOperator* GEPOp);
+    static constexpr uint32_t InvalidID = UINT32_MAX;
 
-    Alias(llvm::Value* Val, std::string Index = "");
-    Alias(llvm::Argument* Arg, std::string Index = "");
-    Alias(llvm::Type* Ty, std::string Index = "");
-    Alias(std::string S, llvm::Function* Func, std::string Index = "");
+    Alias(llvm::Value* Val);
+    Alias(llvm::Argument* Arg);
+    Alias(llvm::Type* Ty);
+    Alias(std::string S, llvm::Function* Func);
     Alias(Alias* A);
 
+    AliasKind getKind() const;
+    uint32_t getID() const;
     llvm::Value* getValue() const;
     llvm::StringRef getName() const;
     std::string getMemTypeName() const;
     std::string getFunctionName() const;
     std::string getFieldIndex() const;
+    const FieldPath* getField() const;
+    const Alias* getBase() const;
+    const HeapContext* getHeapContext() const;
     friend std::ostream& operator<<(std::ostream& OS, const Alias& A);
 
     bool isMem() const;
     bool isArg() const;
     bool isField() const;
+    bool isOrig() const;
+    bool isHeap() const;
     bool isGlobalVar() const;
     bool isAllocaOrArgOrGlobal() const;
     bool sameFunc(llvm::Function* Func) const;
@@ -65,6 +164,34 @@ class Alias {
     bool operator==(const Alias& TheAlias) const;
     void operator=(const Alias& TheAlias);
 };
+
+// Tokens are allocated by the million, keep them within half a cache line and
+// releasable without running destructors
+static_assert(sizeof(Alias) <= 32, "Alias should fit in 32 bytes");
+static_assert(std::is_trivially_destructible<Alias>::value,
+              "Alias should be trivially destructible");
 }  // namespace AliasUtil
 
+namespace llvm {
+template <>
+struct DenseMapInfo<AliasUtil::AliasKey> {
+    static inline AliasUtil::AliasKey getEmptyKey() {
+        return {DenseMapInfo<const void*>::getEmptyKey(), nullptr, nullptr,
+                AliasUtil::AliasKind::Value};
+    }
+    static inline AliasUtil::AliasKey getTombstoneKey() {
+        return {DenseMapInfo<const void*>::getTombstoneKey(), nullptr, nullptr,
+                AliasUtil::AliasKind::Value};
+    }
+    static unsigned getHashValue(const AliasUtil::AliasKey& Key) {
+        return hash_combine(Key.Ptr, Key.Func, Key.Field,
+                            static_cast<uint8_t>(Key.Kind));
+    }
+    static bool isEqual(const AliasUtil::AliasKey& LHS,
+                        const AliasUtil::AliasKey& RHS) {
+        return LHS == RHS;
+    }
+};
+}  // namespace llvm
+
 #endif
@@ -0,0 +1,100 @@
+#ifndef ALIASSET_H
+#define ALIASSET_H
+
+#include "Alias.h"
+#include "llvm/ADT/Hashing.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/iterator.h"
+#include "cstdint"
+#include "memory"
+#include "unordered_map"
+#include "vector"
+
+namespace AliasUtil {
+
+class AliasTokens;
+
+/// AliasSet - A set of tokens of one AliasTokens bank identified by their
+/// ids. Up to SmallSize tokens are kept in a sorted inline array, larger sets
+/// are a bitset over the ids of the bank. The set operations return true if
+/// the set changed, to be used as the changed flag of fixed point loops.
+///
+/// The set holds ids, it must not be used after AliasTokens::compact and
+/// must not hold released or evicted tokens
+class AliasSet {
+   public:
+    static constexpr unsigned SmallSize = 8;
+
+   private:
+    const AliasTokens* Bank;
+    // Sorted ids of a small set
+    llvm::SmallVector<uint32_t, SmallSize> Small;
+    // Bit i of word i / 64 is set for id i in a large set, trailing words
+    // may be zero
+    std::vector<uint64_t> Words;
+    bool IsSmall = true;
+    size_t Count = 0;
+
+    bool insertID(uint32_t);
+    bool eraseID(uint32_t);
+    void grow();
+    void shrink();
+
+   public:
+    /// iterator - Walks the tokens of the set in the order of their ids
+    class iterator
+        : public llvm::iterator_facade_base<iterator, std::forward_iterator_tag,
+                                            Alias*, std::ptrdiff_t, Alias**,
+                                            Alias*> {
+       private:
+        const AliasSet* Set;
+        uint32_t ID;
+
+       public:
+        iterator(const AliasSet* Set, uint32_t ID) : Set(Set), ID(ID) {}
+        Alias* operator*() const;
+        iterator& operator++();
+        bool operator==(const iterator& Other) const { return ID == Other.ID; }
+    };
+
+    explicit AliasSet(const AliasTokens& Bank);
+
+    bool insert(const Alias*);
+    bool erase(const Alias*);
+    bool contains(const Alias*) const;
+    bool contains(uint32_t) const;
+    void clear();
+
+    bool unionWith(const AliasSet&);
+    bool intersectWith(const AliasSet&);
+    bool subtract(const AliasSet&);
+
+    size_t size() const;
+    bool empty() const;
+    bool isSmall() const;
+    iterator begin() const;
+    iterator end() const;
+    uint32_t findNext(uint32_t) const;
+
+    bool operator==(const AliasSet&) const;
+    bool operator!=(const AliasSet& Other) const { return !(*this == Other); }
+    friend llvm::hash_code hash_value(const AliasSet&);
+};
+
+/// AliasSetPool - Hash conses sets, equal sets interned in the same pool are
+/// the same object and can be compared by pointer
+class AliasSetPool {
+   private:
+    std::vector<std::unique_ptr<const AliasSet>> Sets;
+    // Sets by their hash, every value of a hash is a valid key unlike the
+    // reserved keys of a DenseMap
+    std::unordered_map<size_t, llvm::SmallVector<const AliasSet*, 1>> Buckets;
+
+   public:
+    const AliasSet* intern(const AliasSet&);
+    size_t size() const;
+};
+
+}  // namespace AliasUtil
+
+#endif
@@ -2,31 +2,451 @@
 #define ALIASTOKEN_H
 
 #include "Alias.h"
+#include "CallBindings.h"
+#include "ModuleTokens.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/BitmaskEnum.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/iterator.h"
+#include "llvm/ADT/iterator_range.h"
+#include "llvm/Support/Allocator.h"
 #include "llvm/IR/Argument.h"
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/InstIterator.h"
 #include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Module.h"
 #include "llvm/IR/Type.h"
 #include "llvm/IR/Value.h"
+#include "llvm/IR/ValueHandle.h"
+#include "atomic"
+#include "memory"
+#include "mutex"
 #include "set"
 #include "string"
+#include "vector"
 
 namespace AliasUtil {
 
+/// OperandRole - The entity a token extracted from a statement stands for
+enum class OperandRole : uint8_t {
+    None,     // No token is extracted
+    Self,     // The instruction, global variable or argument itself
+    Pointer,  // The pointer operand of a memory access or GEP
+    Value,    // The stored or returned value
+    Source,   // The casted value, or the heap token of a new allocation
+    Orig,     // The orig token standing for the allocated location
+};
+
+/// StatementKind - Relative level of redirection and operand role of the LHS
+/// and RHS of a statement
+template <int LHSLvl, int RHSLvl, OperandRole LHSRole, OperandRole RHSRole>
+struct StatementKind {
+    static constexpr int LHSLevel = LHSLvl;
+    static constexpr int RHSLevel = RHSLvl;
+    static constexpr OperandRole LHS = LHSRole;
+    static constexpr OperandRole RHS = RHSRole;
+
+    static constexpr std::pair<int, int> getStatementType() {
+        return {LHSLvl, RHSLvl};
+    }
+};
+
+template <int LHSLvl, int RHSLvl, OperandRole LHSRole, OperandRole RHSRole>
+constexpr int StatementKind<LHSLvl, RHSLvl, LHSRole, RHSRole>::LHSLevel;
+template <int LHSLvl, int RHSLvl, OperandRole LHSRole, OperandRole RHSRole>
+constexpr int StatementKind<LHSLvl, RHSLvl, LHSRole, RHSRole>::RHSLevel;
+template <int LHSLvl, int RHSLvl, OperandRole LHSRole, OperandRole RHSRole>
+constexpr OperandRole StatementKind<LHSLvl, RHSLvl, LHSRole, RHSRole>::LHS;
+template <int LHSLvl, int RHSLvl, OperandRole LHSRole, OperandRole RHSRole>
+constexpr OperandRole StatementKind<LHSLvl, RHSLvl, LHSRole, RHSRole>::RHS;
+
+/// StatementTraits - Statement kind of each entity class handled by
+/// extractTokens, usable at compile time by clients templated on the
+/// instruction class. Unhandled classes are {1, 1} with no tokens
+template <typename Ty>
+struct StatementTraits
+    : StatementKind<1, 1, OperandRole::None, OperandRole::None> {};
+// x = alloca
+template <>
+struct StatementTraits<llvm::AllocaInst>
+    : StatementKind<1, 0, OperandRole::Self, OperandRole::Orig> {};
+// @x = global
+template <>
+struct StatementTraits<llvm::GlobalVariable>
+    : StatementKind<1, 0, OperandRole::Self, OperandRole::Orig> {};
+// x = gep y ...
+template <>
+struct StatementTraits<llvm::GetElementPtrInst>
+    : StatementKind<1, 0, OperandRole::Self, OperandRole::Pointer> {};
+// store y x
+template <>
+struct StatementTraits<llvm::StoreInst>
+    : StatementKind<2, 1, OperandRole::Pointer, OperandRole::Value> {};
+// x = load y
+template <>
+struct StatementTraits<llvm::LoadInst>
+    : StatementKind<1, 2, OperandRole::Self, OperandRole::Pointer> {};
+// x = bitcast y
+template <>
+struct StatementTraits<llvm::BitCastInst>
+    : StatementKind<1, 1, OperandRole::Self, OperandRole::Source> {};
+// return x
+template <>
+struct StatementTraits<llvm::ReturnInst>
+    : StatementKind<1, 1, OperandRole::Value, OperandRole::None> {};
+// x = call ...
+template <>
+struct StatementTraits<llvm::CallInst>
+    : StatementKind<1, 1, OperandRole::Self, OperandRole::None> {};
+// x = phi y z ...
+template <>
+struct StatementTraits<llvm::PHINode>
+    : StatementKind<1, 1, OperandRole::Self, OperandRole::Value> {};
+// x = select c y z
+template <>
+struct StatementTraits<llvm::SelectInst>
+    : StatementKind<1, 1, OperandRole::Self, OperandRole::Value> {};
+// x = invoke ...
+template <>
+struct StatementTraits<llvm::InvokeInst>
+    : StatementKind<1, 1, OperandRole::Self, OperandRole::None> {};
+// memcpy x y, memmove x y
+template <>
+struct StatementTraits<llvm::MemTransferInst>
+    : StatementKind<2, 2, OperandRole::Pointer, OperandRole::Pointer> {};
+// cmpxchg x cmp y
+template <>
+struct StatementTraits<llvm::AtomicCmpXchgInst>
+    : StatementKind<2, 1, OperandRole::Pointer, OperandRole::Value> {};
+// atomicrmw op x y
+template <>
+struct StatementTraits<llvm::AtomicRMWInst>
+    : StatementKind<2, 1, OperandRole::Pointer, OperandRole::Value> {};
+// Argument x of a function
+template <>
+struct StatementTraits<llvm::Argument>
+    : StatementKind<1, 1, OperandRole::Self, OperandRole::Orig> {};
+
+/// ExtractedTokens - Alias tokens extracted from an instruction, argument or
+/// global variable, kept inline for up to two tokens, along with the relative
+/// level of redirection of the LHS and RHS of the statement
+class ExtractedTokens : public llvm::SmallVector<Alias*, 2> {
+   public:
+    int LHSLevel = 1;
+    int RHSLevel = 1;
+
+    ExtractedTokens() = default;
+    ExtractedTokens(std::pair<int, int> StatementType)
+        : LHSLevel(StatementType.first), RHSLevel(StatementType.second) {}
+
+    std::pair<int, int> getStatementType() const {
+        return {LHSLevel, RHSLevel};
+    }
+    std::vector<Alias*> vec() const { return {begin(), end()}; }
+};
+
+class AliasTokens;
+
+/// Statement - An instruction abstracted into its LHS and RHS tokens and their
+/// relative level of redirection. RHS is nullptr for single token statements,
+/// an instruction with several RHS tokens like a PHI gives one statement per
+/// RHS
+struct Statement {
+    llvm::Instruction* Inst = nullptr;
+    Alias* LHS = nullptr;
+    Alias* RHS = nullptr;
+    int LHSLevel = 1;
+    int RHSLevel = 1;
+};
+
+/// StatementIterator - Walks the instructions of a function in program order
+/// and yields a Statement for each one that extractTokens abstracts into
+/// tokens, tokens are extracted lazily as the iterator advances
+class StatementIterator
+    : public llvm::iterator_facade_base<StatementIterator,
+                                        std::forward_iterator_tag,
+                                        const Statement> {
+   private:
+    AliasTokens* AT;
+    llvm::inst_iterator Current;
+    llvm::inst_iterator End;
+    ExtractedTokens Tokens;
+    unsigned RHSIndex = 0;
+    Statement Stmt;
+    void settle();
+    void fill();
+
+   public:
+    StatementIterator(AliasTokens* AT, llvm::inst_iterator Begin,
+                      llvm::inst_iterator End);
+
+    const Statement& operator*() const { return Stmt; }
+    StatementIterator& operator++();
+    bool operator==(const StatementIterator& Other) const {
+        return Current == Other.Current && RHSIndex == Other.RHSIndex;
+    }
+};
+
+class TokenSnapshot;
+
+/// HeapAbstraction - The objects a heap token of a bank stands for, from the
+/// coarsest to the finest
+enum class HeapAbstraction : uint8_t {
+    Type,        // Every object allocated with the same type
+    Site,        // Every object allocated at the same allocation site
+    CallString,  // The objects of a site allocated in the same k-limited
+                 // calling context
+};
+
+/// BankFlags - Options of an AliasTokens bank, combined with |
+enum class BankFlags : uint8_t {
+    None = 0,
+    Concurrent = 1 << 0,      // Tokens may be requested from several threads
+    FunctionScoped = 1 << 1,  // Tokens local to a function can be released
+    Tracking = 1 << 2,        // Tokens follow the deleted or replaced values
+    LLVM_MARK_AS_BITMASK_ENUM(/* LargestValue = */ Tracking)
+};
+LLVM_ENABLE_BITMASK_ENUMS_IN_NAMESPACE();
+
 class AliasTokens {
+   public:
+    /// Lookup - The getAliasToken overload or extraction path a token was
+    /// requested through, used to break down the statistics of the bank
+    enum class Lookup : uint8_t {
+        Value,
+        Argument,
+        Type,
+        Instruction,
+        Alias,
+        Dummy,
+        Field,
+        Snapshot,
+        Orig,
+        Merge,
+        Heap,
+    };
+    static constexpr unsigned NumLookups = 11;
+
+    /// Remap - The token of a bank standing for each id of a bank merged into
+    /// it, nullptr for released ids
+    using Remap = std::vector<Alias*>;
+
    private:
-    std::map<std::string, Alias*> AliasBank;
-    bool isCached(Alias*);
-    bool insert(Alias*);
+    friend class TokenSnapshot;
+
+    /// Shard - A stripe of the bank guarded by its own lock. Tokens are placed
+    /// in the shard selected by their underlying entity so the entity index
+    /// and the bank of a token always share the lock
+    struct Shard {
+        std::mutex Lock;
+        llvm::DenseMap<AliasKey, Alias*> AliasBank;
+        // Side index from the underlying Value, Type or Argument to its token
+        // without field index, answers repeated lookups without allocation
+        llvm::DenseMap<const void*, Alias*> EntityIndex;
+        // Every token owned by the shard is allocated here, tokens stay at a
+        // fixed address until the bank or the function is released. Alias is
+        // trivially destructible so releasing only frees the slabs
+        llvm::BumpPtrAllocator Arena;
+        // Tokens of the shard evicted after a change of the IR, their slots
+        // move to FreeList on compact and are reused for new tokens
+        std::vector<Alias*> Evicted;
+        std::vector<Alias*> FreeList;
+    };
+
+    // Locks are only taken when the bank is shared between threads
+    bool Concurrent;
+    unsigned NumShards;
+    std::unique_ptr<Shard[]> Shards;
+    // Tokens local to a function are kept in a shard of their own, which
+    // releaseFunction frees, when the bank is function scoped
+    bool FunctionScoped;
+    mutable std::mutex FunctionBanksLock;
+    llvm::DenseMap<const llvm::Function*, std::unique_ptr<Shard>>
+        FunctionBanks;
+    // Tokens follow the deletion and replacement of the values they are
+    // derived from when the bank is tracking
+    bool Tracking;
+    // Tokens indexed by their dense id, released and evicted tokens are
+    // nullptr until compact
+    mutable std::mutex TokensLock;
+    std::vector<Alias*> Tokens;
+    // Number of released and evicted tokens
+    size_t NumReleased = 0;
+    // Orig token of each token indexed by the id of the base, nullptr until
+    // the orig token is requested. Guarded by TokensLock
+    std::vector<Alias*> Origs;
+    // Trie of field paths, maps a path and an index to the extended path
+    std::mutex FieldLock;
+    llvm::DenseMap<std::pair<const FieldPath*, int64_t>, FieldPath*>
+        FieldPaths;
+    llvm::BumpPtrAllocator FieldArena;
+    // Heap abstraction of the bank, see setHeapAbstraction
+    HeapAbstraction HeapMode;
+    unsigned HeapDepth;
+    size_t MaxHeapTokens;
+    std::atomic<size_t> NumHeapTokens{0};
+    // Trie of allocation contexts, maps a context and a call site to the
+    // extended context. Roots are keyed by a null context and their site
+    std::mutex HeapLock;
+    llvm::DenseMap<std::pair<const HeapContext*, const llvm::Instruction*>,
+                   HeapContext*>
+        HeapContexts;
+    llvm::BumpPtrAllocator HeapArena;
+
+    /// HeapSiteHandle - Watches a site of the allocation contexts of a
+    /// tracking bank, the contexts through the site and their heap tokens
+    /// are evicted when it is deleted
+    class HeapSiteHandle final : public llvm::CallbackVH {
+       private:
+        AliasTokens* Bank;
+        void deleted() override;
+
+       public:
+        HeapSiteHandle(llvm::Value* V = nullptr, AliasTokens* Bank = nullptr);
+    };
+
+    // Sites of the allocation contexts of a tracking bank, guarded by HeapLock
+    // and HandlesLock
+    llvm::DenseMap<const llvm::Value*, HeapSiteHandle> HeapSites;
+    size_t evictHeapContexts(
+        llvm::function_ref<bool(const llvm::Instruction*)>);
+    // Printed names of heap types, a type is printed the first time its name
+    // is requested and its name stays in TypeNameArena
+    std::mutex TypeNameLock;
+    llvm::DenseMap<const llvm::Type*, llvm::StringRef> TypeNames;
+    llvm::BumpPtrAllocator TypeNameArena;
+
+    /// ExtractionHandle - Watches a value used by cached extraction results,
+    /// the results are invalidated when the value is deleted or replaced
+    class ExtractionHandle final : public llvm::CallbackVH {
+       private:
+        AliasTokens* Bank;
+        void deleted() override;
+        void allUsesReplacedWith(llvm::Value*) override;
+
+       public:
+        ExtractionHandle(llvm::Value* V = nullptr, AliasTokens* Bank = nullptr);
+    };
+
+    // Results of extractCachedAliasToken, the tokens are stored in CacheArena.
+    // CacheHandles is guarded by CacheLock and HandlesLock
+    std::mutex CacheLock;
+    llvm::DenseMap<const llvm::Instruction*, llvm::ArrayRef<Alias*>>
+        ExtractionCache;
+    llvm::DenseMap<const llvm::Value*, ExtractionHandle> CacheHandles;
+    llvm::BumpPtrAllocator CacheArena;
+    void invalidateCached(llvm::Value*);
+
+    /// TokenHandle - Watches the value tokens of a tracking bank are derived
+    /// from, the tokens are evicted when the value is deleted and remapped
+    /// when it is replaced
+    class TokenHandle final : public llvm::CallbackVH {
+       private:
+        AliasTokens* Bank;
+        void deleted() override;
+        void allUsesReplacedWith(llvm::Value*) override;
+
+       public:
+        // Tokens derived from the value, its fields and orig tokens, and the
+        // dummy tokens local to a function
+        llvm::SmallVector<Alias*, 2> Tokens;
+
+        TokenHandle(llvm::Value* V = nullptr, AliasTokens* Bank = nullptr);
+    };
+
+    // Every value handle of the bank, in Handles, CacheHandles and HeapSites,
+    // is created, moved and destroyed under HandlesLock. The handles of a
+    // value are linked in a list of its LLVMContext, which is not thread
+    // safe. HandlesLock is taken last, after HeapLock, CacheLock or the lock
+    // of a shard
+    std::mutex HandlesLock;
+    llvm::DenseMap<const llvm::Value*, TokenHandle> Handles;
+    static llvm::Value* getRoot(const Alias*);
+    void track(Alias*);
+    void untrack(Alias*);
+    void unlink(Shard&, Alias*);
+    void discard(Shard&, Alias*);
+    void valueDeleted(llvm::Value*);
+    void valueReplaced(llvm::Value*, llvm::Value*);
+
+    // Number of instructions of each opcode extractTokens could not abstract
+    std::atomic<unsigned> Unsupported[llvm::Instruction::OtherOpsEnd];
+    std::atomic<unsigned> Printed{0};
+    void reportUnsupported(llvm::Instruction*);
+
+    // Counters of the bank, only allocated and updated when the library is
+    // built with ALIASTOKEN_ENABLE_STATS
+    struct BankStats;
+    std::unique_ptr<BankStats> Stats;
+
+    std::unique_lock<std::mutex> lock(std::mutex&) const;
+    Shard& getShard(const void*, const llvm::Function*);
+    Shard& getFunctionShard(const llvm::Function*);
+    AliasKey getKey(const Alias*);
+    Alias* getCanonical(Shard&, Alias&, Lookup);
+    Alias* getCanonical(Alias&, Lookup);
+    const FieldPath* getFieldPath(const FieldPath*, int64_t);
+    const FieldPath* importField(const FieldPath*);
+    const HeapContext* getHeapContext(const HeapContext*, llvm::Instruction*,
+                                      llvm::Type*, bool Create = true);
+    const HeapContext* importHeap(const HeapContext*);
+    template <typename EntityTy>
+    Alias* getEntityToken(EntityTy*, Lookup);
+    Alias* bindToken(Alias&, const FieldPath*);
 
    public:
+    // Number of shards of a concurrent bank
+    static constexpr unsigned ConcurrentShards = 64;
+
+    explicit AliasTokens(BankFlags Flags = BankFlags::None);
+
     Alias* getAliasToken(llvm::Value*);
     Alias* getAliasToken(llvm::Argument*);
     Alias* getAliasToken(llvm::Type*);
     Alias* getAliasToken(llvm::Instruction*);
     Alias* getAliasToken(Alias*);
     Alias* getAliasToken(std::string, llvm::Function*);
+    Alias* getOrig(Alias*);
+    Alias* getHeapToken(llvm::CallBase*, llvm::Type*,
+                        llvm::ArrayRef<llvm::CallBase*> CallString = {});
+    Alias* getAllocationToken(llvm::CallBase*,
+                              llvm::ArrayRef<llvm::CallBase*> CallString = {});
+
+    void setHeapAbstraction(HeapAbstraction, unsigned K = 1,
+                            size_t MaxTokens = 0);
+    HeapAbstraction getHeapAbstraction() const;
+    static bool isAllocation(const llvm::CallBase*);
+
+    Alias* lookup(uint32_t) const;
+    llvm::ArrayRef<Alias*> tokens() const;
+
+    size_t releaseFunction(const llvm::Function*);
+    size_t compact();
+
+    llvm::StringRef getTypeName(llvm::Type*);
+    llvm::StringRef getMemTypeName(const Alias*);
+
+    ExtractedTokens extractTokens(llvm::Instruction*);
+    ExtractedTokens extractTokens(llvm::StoreInst*);
+    ExtractedTokens extractTokens(llvm::LoadInst*);
+    ExtractedTokens extractTokens(llvm::AllocaInst*);
+    ExtractedTokens extractTokens(llvm::BitCastInst*);
+    ExtractedTokens extractTokens(llvm::ReturnInst*);
+    ExtractedTokens extractTokens(llvm::GetElementPtrInst*);
+    ExtractedTokens extractTokens(llvm::GlobalVariable*);
+    ExtractedTokens extractTokens(llvm::CallInst*);
+    ExtractedTokens extractTokens(llvm::PHINode*);
+    ExtractedTokens extractTokens(llvm::SelectInst*);
+    ExtractedTokens extractTokens(llvm::InvokeInst*);
+    ExtractedTokens extractTokens(llvm::MemTransferInst*);
+    ExtractedTokens extractTokens(llvm::AtomicCmpXchgInst*);
+    ExtractedTokens extractTokens(llvm::AtomicRMWInst*);
+    ExtractedTokens extractTokens(llvm::Argument*, llvm::Function*);
 
     std::vector<Alias*> extractAliasToken(llvm::Instruction*);
     std::vector<Alias*> extractAliasToken(llvm::StoreInst*);
@@ -39,15 +459,42 @@ class AliasTokens {
     std::vector<Alias*> extractAliasToken(llvm::CallInst*);
     std::vector<Alias*> extractAliasToken(llvm::Argument*, llvm::Function*);
 
+    ModuleTokens extractModule(llvm::Module&, unsigned Threads = 0);
+    std::vector<Remap> merge(llvm::ArrayRef<AliasTokens*> Banks,
+                             unsigned Threads = 0);
+    CallBindings bindCalls(llvm::Module&,
+                           CallBindings::CalleeResolver Resolve = nullptr);
+    void serialize(llvm::raw_ostream&, const llvm::Module&);
+
+    static bool isSupported(const llvm::Instruction*);
+    void printUnsupported(llvm::raw_ostream&) const;
+    llvm::iterator_range<StatementIterator> statements(llvm::Function&);
+    void forEachStatement(llvm::Function&,
+                          llvm::function_ref<void(const Statement&)>);
+
+    llvm::ArrayRef<Alias*> extractCachedAliasToken(llvm::Instruction*);
+    void clearExtractionCache();
+
     template <typename Ty>
     std::pair<int, int> extractStatementType(Ty*);
 
     template <typename GEP>
     Alias* handleGEPUtil(GEP*, Alias*);
 
+    size_t size() const;
+    size_t getMemoryUsage() const;
+    void dumpStats(llvm::raw_ostream&, bool JSON = false) const;
+
     ~AliasTokens();
 };
 
+template <>
+std::pair<int, int> AliasTokens::extractStatementType<llvm::Instruction>(
+    llvm::Instruction*);
+template <>
+std::pair<int, int> AliasTokens::extractStatementType<llvm::GlobalVariable>(
+    llvm::GlobalVariable*);
+
 }  // namespace AliasUtil
 
 #endif
@@ -0,0 +1,80 @@
+#ifndef ALIASTOKENANALYSIS_H
+#define ALIASTOKENANALYSIS_H
+
+#include "AliasToken.h"
+#include "ModuleTokens.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/PassManager.h"
+#include "llvm/Pass.h"
+#include "llvm/Support/raw_ostream.h"
+#include "memory"
+
+namespace AliasUtil {
+
+/// AliasTokenResult - The token bank of a module shared by every pass of a
+/// pipeline, along with the tokens extracted for the module
+class AliasTokenResult {
+   private:
+    std::unique_ptr<AliasTokens> Bank;
+    ModuleTokens Tokens;
+
+   public:
+    AliasTokenResult(llvm::Module&, unsigned Threads);
+
+    AliasTokens& getBank();
+    const ModuleTokens& getModuleTokens() const;
+    llvm::ArrayRef<Alias*> get(const llvm::Value*) const;
+
+    bool invalidate(llvm::Module&, const llvm::PreservedAnalyses&,
+                    llvm::ModuleAnalysisManager::Invalidator&);
+};
+
+/// AliasTokenAnalysis - New pass manager analysis tokenizing a module once,
+/// retrieved with MAM.getResult<AliasTokenAnalysis>(M)
+class AliasTokenAnalysis
+    : public llvm::AnalysisInfoMixin<AliasTokenAnalysis> {
+   private:
+    friend llvm::AnalysisInfoMixin<AliasTokenAnalysis>;
+    static llvm::AnalysisKey Key;
+    unsigned Threads;
+
+   public:
+    using Result = AliasTokenResult;
+
+    explicit AliasTokenAnalysis(unsigned Threads = 1);
+    Result run(llvm::Module&, llvm::ModuleAnalysisManager&);
+};
+
+/// AliasTokenPrinterPass - Prints the statistics of the bank of a module,
+/// print<alias-tokens> in a pipeline
+class AliasTokenPrinterPass
+    : public llvm::PassInfoMixin<AliasTokenPrinterPass> {
+   private:
+    llvm::raw_ostream& OS;
+
+   public:
+    explicit AliasTokenPrinterPass(llvm::raw_ostream& OS);
+    llvm::PreservedAnalyses run(llvm::Module&, llvm::ModuleAnalysisManager&);
+};
+
+/// AliasTokenWrapperPass - Legacy pass manager wrapper of AliasTokenAnalysis,
+/// retrieved with getAnalysis<AliasTokenWrapperPass>().getResult()
+class AliasTokenWrapperPass : public llvm::ModulePass {
+   private:
+    std::unique_ptr<AliasTokenResult> Result;
+
+   public:
+    static char ID;
+
+    AliasTokenWrapperPass();
+
+    AliasTokenResult& getResult();
+    bool runOnModule(llvm::Module&) override;
+    void getAnalysisUsage(llvm::AnalysisUsage&) const override;
+    void releaseMemory() override;
+    void print(llvm::raw_ostream&, const llvm::Module*) const override;
+};
+
+}  // namespace AliasUtil
+
+#endif
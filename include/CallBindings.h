@@ -0,0 +1,70 @@
+#ifndef CALLBINDINGS_H
+#define CALLBINDINGS_H
+
+#include "Alias.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/InstrTypes.h"
+#include "vector"
+
+namespace AliasUtil {
+
+/// CallBindings - Bindings of the call sites of a module built once by
+/// AliasTokens::bindCalls. Each call and each of its callees is a site whose
+/// actual argument tokens are bound to the formal argument tokens of the
+/// callee, and whose returned tokens are bound to the token of the result
+class CallBindings {
+   public:
+    /// Binding - Source flows into Target. For an argument Source is the
+    /// actual argument and Target the formal argument, for a return Source is
+    /// the returned value and Target the result of the call
+    struct Binding {
+        Alias* Source;
+        Alias* Target;
+    };
+
+    /// Site - A call and one of its callees
+    struct Site {
+        llvm::CallBase* Call;
+        llvm::Function* Callee;
+
+       private:
+        friend class AliasTokens;
+        friend class CallBindings;
+        // Position of the bindings of the site in Arguments and Returns
+        unsigned ArgBegin;
+        unsigned RetBegin;
+    };
+
+    /// CalleeResolver - Adds the possible callees of an indirect call to the
+    /// vector
+    using CalleeResolver = llvm::function_ref<void(
+        llvm::CallBase*, llvm::SmallVectorImpl<llvm::Function*>&)>;
+
+   private:
+    friend class AliasTokens;
+
+    // Sites in program order followed by a sentinel, the bindings of the
+    // i-th site end where the bindings of the next one begin
+    std::vector<Site> Sites;
+    std::vector<Binding> Arguments;
+    std::vector<Binding> Returns;
+    // Position of the first site of each call in Sites and its number of
+    // callees
+    llvm::DenseMap<const llvm::CallBase*, std::pair<unsigned, unsigned>>
+        Calls;
+
+   public:
+    llvm::ArrayRef<Site> sites() const;
+    llvm::ArrayRef<Site> getSites(const llvm::CallBase*) const;
+    llvm::ArrayRef<Binding> getArguments(const Site&) const;
+    llvm::ArrayRef<Binding> getReturns(const Site&) const;
+    size_t size() const;
+};
+
+}  // namespace AliasUtil
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef MODULETOKENS_H
+#define MODULETOKENS_H
+
+#include "Alias.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/IR/Value.h"
+#include "vector"
+
+namespace AliasUtil {
+
+/// ModuleTokens - Alias tokens extracted for every instruction, argument and
+/// global variable of a module by AliasTokens::extractModule. The tokens of
+/// an entity are the ones extractAliasToken returns for it
+class ModuleTokens {
+   private:
+    friend class AliasTokens;
+
+    // Position of each entity in Offsets
+    llvm::DenseMap<const llvm::Value*, unsigned> Entities;
+    // Tokens of the i-th entity are Storage[Offsets[i], Offsets[i + 1])
+    std::vector<unsigned> Offsets;
+    std::vector<Alias*> Storage;
+
+   public:
+    llvm::ArrayRef<Alias*> get(const llvm::Value*) const;
+    bool contains(const llvm::Value*) const;
+    size_t size() const;
+};
+
+}  // namespace AliasUtil
+
+#endif
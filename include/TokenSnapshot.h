@@ -0,0 +1,117 @@
+#ifndef TOKENSNAPSHOT_H
+#define TOKENSNAPSHOT_H
+
+#include "Alias.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/AsmParser/SlotMapping.h"
+#include "llvm/IR/Instruction.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/Endian.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "memory"
+#include "vector"
+
+namespace AliasUtil {
+
+class AliasTokens;
+
+/// TokenSnapshot - Tokens of a bank read back from the image written by
+/// AliasTokens::serialize. The image is mapped as is and a token is bound to
+/// the IR of the module, and added to the bank, on its first request.
+///
+/// The image is a header followed by the field path nodes, the token records
+/// in the order of their ids and the string table, every integer is little
+/// endian and records are read in place
+class TokenSnapshot {
+   public:
+    struct Header {
+        char Magic[8];
+        llvm::support::ulittle32_t Version;
+        llvm::support::ulittle32_t NumTokens;
+        llvm::support::ulittle64_t ModuleHash;
+        llvm::support::ulittle32_t NumFields;
+        llvm::support::ulittle32_t NumStrings;
+        llvm::support::ulittle32_t StringBytes;
+        llvm::support::ulittle32_t Reserved;
+    };
+
+    // A field path node, its parent comes before it
+    struct FieldRecord {
+        llvm::support::little64_t Index;
+        llvm::support::ulittle32_t Parent;
+        llvm::support::ulittle32_t Reserved;
+    };
+
+    // Entity is the index of the instruction in its function for values
+    // local to a function, the string of the name for globals, dummy tokens
+    // and heap types, the argument number for arguments and the id of the
+    // base token for orig tokens
+    struct TokenRecord {
+        uint8_t Kind;
+        uint8_t Flags;
+        llvm::support::ulittle16_t Reserved;
+        llvm::support::ulittle32_t Field;
+        llvm::support::ulittle32_t Func;
+        llvm::support::ulittle32_t Entity;
+    };
+
+    static constexpr char Magic[8] = {'A', 'L', 'I', 'A', 'S', 'T', 'O', 'K'};
+    static constexpr uint32_t Version = 2;
+    // Absent field, function or string
+    static constexpr uint32_t None = UINT32_MAX;
+    // Flags of a token record
+    static constexpr uint8_t Bindable = 1;
+
+   private:
+    std::unique_ptr<llvm::MemoryBuffer> Buffer;
+    llvm::Module& M;
+    AliasTokens& Bank;
+    const Header* Head;
+    const FieldRecord* Fields;
+    const TokenRecord* Records;
+    const llvm::support::ulittle32_t* StringOffsets;
+    const char* Strings;
+    // Tokens and field paths bound so far, nullptr until requested
+    std::vector<Alias*> Bound;
+    std::vector<const FieldPath*> BoundFields;
+    // Types parsed so far by string id, records of one type share the string
+    std::vector<llvm::Type*> BoundTypes;
+    // Instructions of the functions tokens were bound in, in program order
+    llvm::DenseMap<const llvm::Function*, std::vector<llvm::Instruction*>>
+        FunctionInsts;
+    // Named structs of the module, heap types are parsed with them so that
+    // a struct is not parsed as a new type. Filled on the first type token
+    llvm::SlotMapping Slots;
+    bool HasSlots = false;
+
+    TokenSnapshot(std::unique_ptr<llvm::MemoryBuffer>, llvm::Module&,
+                  AliasTokens&);
+    llvm::Error validate();
+    llvm::StringRef getString(uint32_t) const;
+    llvm::Function* getFunction(uint32_t);
+    const FieldPath* getField(uint32_t);
+    llvm::Type* getType(uint32_t);
+
+   public:
+    static uint64_t getModuleHash(const llvm::Module&);
+    static llvm::Expected<std::unique_ptr<TokenSnapshot>> open(
+        const llvm::Twine& Path, llvm::Module&, AliasTokens&);
+    static llvm::Expected<std::unique_ptr<TokenSnapshot>> load(
+        std::unique_ptr<llvm::MemoryBuffer>, llvm::Module&, AliasTokens&);
+
+    size_t size() const;
+    Alias* getToken(uint32_t);
+};
+
+static_assert(sizeof(TokenSnapshot::Header) == 40,
+              "Snapshot header layout is part of the format");
+static_assert(sizeof(TokenSnapshot::FieldRecord) == 16,
+              "Snapshot field layout is part of the format");
+static_assert(sizeof(TokenSnapshot::TokenRecord) == 16,
+              "Snapshot token layout is part of the format");
+
+}  // namespace AliasUtil
+
+#endif
@@ -1,160 +1,248 @@
 #include "Alias.h"
+#include "llvm/ADT/StringSet.h"
+#include "mutex"
+#include "tuple"
 
 namespace AliasUtil {
 
-void Alias::set(llvm::Value* Val, unsigned int Kind, std::string Index,
+constexpr int64_t FieldPath::Variable;
+constexpr uint32_t Alias::InvalidID;
+
+FieldPath::FieldPath(const FieldPath* Parent, int64_t Index)
+    : Parent(Parent), Index(Index), Depth(Parent ? Parent->Depth + 1 : 1) {}
+
+/// getParent - Returns the path without the last index, nullptr for a path
+/// with a single index
+const FieldPath* FieldPath::getParent() const { return this->Parent; }
+
+/// getIndex - Returns the last index of the path
+int64_t FieldPath::getIndex() const { return this->Index; }
+
+/// getDepth - Returns the number of indices in the path
+unsigned FieldPath::getDepth() const { return this->Depth; }
+
+/// isVariable - Returns true if the last index of the path is not a constant
+bool FieldPath::isVariable() const { return this->Index == Variable; }
+
+HeapContext::HeapContext(const HeapContext* Parent, llvm::Instruction* Site,
+                         llvm::Type* Ty)
+    : Parent(Parent),
+      Site(Site),
+      Ty(Ty),
+      Depth(Parent ? Parent->Depth + 1 : 0) {}
+
+/// getParent - Returns the context without the outermost call site, nullptr
+/// for an allocation site
+const HeapContext* HeapContext::getParent() const { return this->Parent; }
+
+/// getSite - Returns the allocation site of a root and the outermost call
+/// site of the context otherwise
+llvm::Instruction* HeapContext::getSite() const { return this->Site; }
+
+/// getAllocation - Returns the root of the context, the allocation site
+const HeapContext* HeapContext::getAllocation() const {
+    const HeapContext* Root = this;
+    while (Root->Parent) Root = Root->Parent;
+    return Root;
+}
+
+/// getType - Returns the type of the objects allocated at the allocation site
+llvm::Type* HeapContext::getType() const {
+    return this->getAllocation()->Ty;
+}
+
+/// getDepth - Returns the number of call sites of the context
+unsigned HeapContext::getDepth() const { return this->Depth; }
+
+namespace {
+/// NameTable - Process wide interned names of dummy tokens. Names are never
+/// released and the entries of a StringSet never move, so the id of a name is
+/// the address of its entry and reading a name back takes no lock
+struct NameTable {
+    std::mutex Lock;
+    llvm::StringSet<> Names;
+};
+using NameEntry = llvm::StringMapEntry<llvm::NoneType>;
+
+NameTable& getNameTable() {
+    static NameTable Table;
+    return Table;
+}
+}  // namespace
+
+/// internName - Returns the id of \p Name in the name table, the empty name is
+/// always 0
+uintptr_t Alias::internName(llvm::StringRef Name) {
+    if (Name.empty()) return 0;
+    NameTable& Table = getNameTable();
+    std::lock_guard<std::mutex> Guard(Table.Lock);
+    const NameEntry& Entry = *Table.Names.insert(Name).first;
+    return reinterpret_cast<uintptr_t>(&Entry);
+}
+
+void Alias::set(llvm::Value* Val, AliasKind Kind, const FieldPath* Field,
                 llvm::Function* Func, bool Global) {
     this->Val = Val;
     this->Kind = Kind;
-    this->Index = Index;
+    this->Field = Field;
     this->Func = Func;
     this->IsGlobal = Global;
     if (!Func) this->IsGlobal = true;
 }
 
-void Alias::set(llvm::Type* Ty, unsigned int Kind, std::string Index) {
+void Alias::set(llvm::Type* Ty, AliasKind Kind, const FieldPath* Field) {
     this->Ty = Ty;
     this->Kind = Kind;
-    this->Index = Index;
+    this->Field = Field;
+    this->Func = nullptr;
     this->IsGlobal = false;
 }
 
-void Alias::set(llvm::Argument* Arg, unsigned int Kind, std::string Index,
+void Alias::set(llvm::Argument* Arg, AliasKind Kind, const FieldPath* Field,
                 llvm::Function* Func) {
     this->Arg = Arg;
     this->Kind = Kind;
-    this->Index = Index;
+    this->Field = Field;
     this->Func = Func;
     this->IsGlobal = false;
 }
 
-void Alias::set(std::string S, unsigned int Kind, std::string Index,
+void Alias::set(uintptr_t NameId, AliasKind Kind, const FieldPath* Field,
+                llvm::Function* Func) {
+    this->NameId = NameId;
+    this->Kind = Kind;
+    this->Field = Field;
+    this->IsGlobal = false;
+    if (!Func) this->IsGlobal = true;
+    this->Func = Func;
+}
+
+void Alias::set(const Alias* Base, AliasKind Kind, const FieldPath* Field,
                 llvm::Function* Func) {
-    this->Val = nullptr;
-    this->name = S;
+    this->Base = Base;
     this->Kind = Kind;
-    this->Index = Index;
+    this->Field = Field;
     this->IsGlobal = false;
     if (!Func) this->IsGlobal = true;
     this->Func = Func;
 }
 
-Alias::Alias(llvm::Value* Val, std::string Index) {
+void Alias::set(const HeapContext* Heap, AliasKind Kind,
+                const FieldPath* Field) {
+    this->Heap = Heap;
+    this->Kind = Kind;
+    this->Field = Field;
+    this->Func = nullptr;
+    this->IsGlobal = false;
+}
+
+Alias::Alias(llvm::Value* Val) {
     if (llvm::Argument* Arg = llvm::dyn_cast<llvm::Argument>(Val)) {
-        set(Arg, /* Kind = */ 2, Index, Arg->getParent());
+        set(Arg, AliasKind::Argument, nullptr, Arg->getParent());
     } else {
         llvm::Function* func = nullptr;
         if (llvm::Instruction* Inst = llvm::dyn_cast<llvm::Instruction>(Val))
             func = Inst->getParent()->getParent();
         if (llvm::isa<llvm::GlobalVariable>(Val) || !func)
-            set(Val, /* Kind = */ 0, Index, func, true);
+            set(Val, AliasKind::Value, nullptr, func, true);
         else
-            set(Val, /* Kind = */ 0, Index, func);
+            set(Val, AliasKind::Value, nullptr, func);
     }
 }
 
-Alias::Alias(llvm::Argument* Arg, std::string Index) {
-    set(Arg, /* Kind = */ 2, Index, Arg->getParent());
+Alias::Alias(llvm::Argument* Arg) {
+    set(Arg, AliasKind::Argument, nullptr, Arg->getParent());
 }
 
-Alias::Alias(llvm::Type* Ty, std::string Index) {
-    set(Ty, /* Kind = */ 1, Index);
+Alias::Alias(llvm::Type* Ty) {
+    set(Ty, AliasKind::Type, nullptr);
 }
 
-Alias::Alias(std::string S, llvm::Function* Func, std::string Index) {
-    set(S, /* Kind = */ 3, Index, Func);
+Alias::Alias(std::string S, llvm::Function* Func) {
+    set(internName(S), AliasKind::Dummy, nullptr, Func);
 }
 
-Alias::Alias(Alias* A) {
-    unsigned int Kind = A->Kind;
-    if (Kind == 0) {
-        set(A->Val, A->Kind, A->Index, A->Func);
-    } else if (Kind == 1) {
-        set(A->Ty, A->Kind, A->Index);
-    } else if (Kind == 2) {
-        set(A->Arg, A->Kind, A->Index, A->Func);
-    } else if (Kind == 3) {
-        set(A->name, A->Kind, A->Index, A->Func);
-    }
-}
+Alias::Alias(Alias* A) { *this = *A; }
 
-/// setIndex - For a GEP Instruction find the offset and store it
-void Alias::setIndex(llvm::GetElementPtrInst* GEPInst) {
-    auto IterRange = GEPInst->indices();
-    auto Iter = IterRange.begin();
-    while (Iter != IterRange.end()) {
-        llvm::Value* temp = &(*Iter->get());
-        // TODO: Can also use getValue of ConstantInt
-        if (llvm::ConstantInt* CI = llvm::dyn_cast<llvm::ConstantInt>(temp))
-            if (CI->isOne())
-                this->Index += "1";
-            else
-                this->Index += "0";
-        Iter++;
-    }
-}
+/// getKind - Returns the kind of entity the alias is derived from
+AliasKind Alias::getKind() const { return this->Kind; }
 
-/// setIndex - For a GEP Operator find the offset and store it
-void Alias::setIndex(llvm::GEPOperator* GEPOp) {
-    auto Iter = GEPOp->idx_begin();
-    while (Iter != GEPOp->idx_end()) {
-        llvm::Value* temp = &(*Iter->get());
-        if (llvm::ConstantInt* CI = llvm::dyn_cast<llvm::ConstantInt>(temp))
-            if (CI->isOne())
-                this->Index += "1";
-            else
-                this->Index += "0";
-        Iter++;
-    }
+/// entity - Returns the live member of the union as an opaque pointer
+const void* Alias::entity() const {
+    if (this->Kind == AliasKind::Type) return this->Ty;
+    if (this->Kind == AliasKind::Argument) return this->Arg;
+    if (this->Kind == AliasKind::Dummy)
+        return reinterpret_cast<const void*>(this->NameId);
+    if (this->Kind == AliasKind::Orig) return this->Base;
+    if (this->Kind == AliasKind::Heap) return this->Heap;
+    return this->Val;
 }
 
+/// getID - Returns the dense id of the token within its bank
+uint32_t Alias::getID() const { return this->ID; }
+
 /// getValue - Returns the underlying Value* for the alias
 llvm::Value* Alias::getValue() const {
-    if (this->Kind == 0) {
+    if (this->Kind == AliasKind::Value) {
         return this->Val;
     }
     return nullptr;
 }
 
+namespace {
+/// getContextName - Returns the function of the allocation site of \p Heap
+/// followed by the callers of its call sites as @f<-g<-h
+std::string getContextName(const HeapContext* Heap) {
+    std::string Name = "";
+    for (const HeapContext* C = Heap; C; C = C->getParent())
+        Name.insert(0, (C->getParent() ? "<-" : "@") +
+                           C->getSite()->getFunction()->getName().str());
+    return Name;
+}
+}  // namespace
+
 std::ostream& operator<<(std::ostream& OS, const Alias& A) {
-    if (!A.isGlobalVar() && (A.Kind == 0 || A.Kind == 2 || A.Kind == 3)) {
+    if (!A.isGlobalVar() && !A.isMem()) {
         OS << "[" << A.Func->getName().str() << "]"
            << " ";
     }
-    if (A.Kind == 0) {
-        OS << A.Val->getName().str();
-    } else if (A.Kind == 1) {
+    if (A.isMem()) {
         OS << A.getMemTypeName();
-    } else if (A.Kind == 2) {
-        OS << A.Arg->getName().str();
-    } else if (A.Kind == 3) {
-        OS << A.name;
-    }
-    if (A.Index != "") {
-        for (char c : A.Index) OS << "[" << c << "]";
+    } else {
+        OS << A.getName().str();
     }
+    if (A.isOrig()) OS << "-orig";
+    if (A.isHeap()) OS << getContextName(A.Heap);
+    OS << A.getFieldIndex();
     return OS;
 }
 
 /// getName - Returns the name of alias with other informations like parent
-/// function etc
+/// function etc, an orig token has the name of its base
 llvm::StringRef Alias::getName() const {
-    if (this->Kind == 0) {
+    if (this->Kind == AliasKind::Value) {
         return this->Val->getName();
-    } else if (this->Kind == 2) {
+    } else if (this->Kind == AliasKind::Argument) {
         return this->Arg->getName();
-    } else if (this->Kind == 3) {
-        return this->name;
+    } else if (this->Kind == AliasKind::Dummy) {
+        if (!this->NameId) return "";
+        return reinterpret_cast<const NameEntry*>(this->NameId)->getKey();
+    } else if (this->Kind == AliasKind::Orig) {
+        return this->Base->getName();
     }
     return "";
 }
 
-/// getMemTypeName - Returns the memory type name
+/// getMemTypeName - Returns the memory type name, the type is printed on each
+/// call, AliasTokens::getMemTypeName prints it once per bank
 std::string Alias::getMemTypeName() const {
     std::string MemTyName = "";
     if (!this->isMem()) return MemTyName;
     llvm::raw_string_ostream RSO(MemTyName);
-    this->Ty->print(RSO);
+    if (this->Kind == AliasKind::Heap)
+        this->Heap->getType()->print(RSO);
+    else
+        this->Ty->print(RSO);
     return MemTyName;
 }
 
@@ -165,20 +253,55 @@ std::string Alias::getFunctionName() const {
     return (this->Func->getName()).str();
 }
 
-/// getFieldIndex - Returns index of the field
-std::string Alias::getFieldIndex() const { return this->Index; }
+/// getFieldIndex - Returns index of the field as [i][j]..., variable indices
+/// are printed as [*]
+std::string Alias::getFieldIndex() const {
+    std::string FieldIndex = "";
+    for (const FieldPath* F = this->Field; F; F = F->getParent()) {
+        std::string Index =
+            F->isVariable() ? "*" : std::to_string(F->getIndex());
+        FieldIndex.insert(0, "[" + Index + "]");
+    }
+    return FieldIndex;
+}
+
+/// getField - Returns the field path of the alias, nullptr if it is not a
+/// field
+const FieldPath* Alias::getField() const { return this->Field; }
+
+/// getBase - Returns the token an orig token is the allocated location of,
+/// nullptr for other tokens
+const Alias* Alias::getBase() const {
+    if (this->Kind == AliasKind::Orig) return this->Base;
+    return nullptr;
+}
+
+/// getHeapContext - Returns the allocation context of a heap token, nullptr
+/// for other tokens
+const HeapContext* Alias::getHeapContext() const {
+    if (this->Kind == AliasKind::Heap) return this->Heap;
+    return nullptr;
+}
 
 /// isMem - Returns true if the alias denotes a location in heap
-bool Alias::isMem() const { return this->Kind == 1; }
+bool Alias::isMem() const {
+    return this->Kind == AliasKind::Type || this->Kind == AliasKind::Heap;
+}
+
+/// isHeap - Returns true if alias denotes the objects of an allocation site
+bool Alias::isHeap() const { return this->Kind == AliasKind::Heap; }
 
 /// isGlobalVar - Returns true if the alias is global
 bool Alias::isGlobalVar() const { return this->IsGlobal; }
 
 /// isArg - Returns true if alias is a function argument
-bool Alias::isArg() const { return this->Kind == 2; }
+bool Alias::isArg() const { return this->Kind == AliasKind::Argument; }
 
 /// isField - Returns true if alias is a field
-bool Alias::isField() const { return this->Index != ""; }
+bool Alias::isField() const { return this->Field != nullptr; }
+
+/// isOrig - Returns true if alias is the allocated location of another token
+bool Alias::isOrig() const { return this->Kind == AliasKind::Orig; }
 
 /// isAllocaOrArgOrGlobal - Returns true if the alias is global, an argument or
 /// alloca
@@ -192,36 +315,56 @@ bool Alias::sameFunc(llvm::Function* Func) const {
     return false;
 }
 
-///  getHash - Calculates the hash for alias to avoid multiple enteries of same
-///  alias
+///  getHash - Builds a printable string identifying the alias. The token bank
+///  uses AliasKey for identity, this is only kept as a debugging aid
 std::string Alias::getHash() const {
     std::string hash = "";
     if (this->isGlobalVar()) hash += "G";
     hash += this->getName().str();
+    if (this->isOrig()) hash += "-orig";
     hash += this->getFunctionName();
     hash += this->getMemTypeName();
+    if (this->isHeap()) hash += getContextName(this->Heap);
     hash += this->getFieldIndex();
     return hash;
 }
 
+/// operator< - Orders tokens of a bank by their id, tokens outside a bank are
+/// ordered after them by their structure
 bool Alias::operator<(const Alias& TheAlias) const {
-    return (this->getHash() < TheAlias.getHash());
+    if (this->ID != TheAlias.ID) return this->ID < TheAlias.ID;
+    return std::make_tuple(this->Kind, this->entity(), this->Func,
+                           this->Field) <
+           std::make_tuple(TheAlias.Kind, TheAlias.entity(), TheAlias.Func,
+                           TheAlias.Field);
 }
 
 bool Alias::operator==(const Alias& TheAlias) const {
-    return (this->getHash() == TheAlias.getHash());
+    if (this->Kind != TheAlias.Kind || this->Field != TheAlias.Field)
+        return false;
+    if (this->Kind == AliasKind::Type) return this->Ty == TheAlias.Ty;
+    if (this->Kind == AliasKind::Heap) return this->Heap == TheAlias.Heap;
+    if (this->Func != TheAlias.Func) return false;
+    if (this->Kind == AliasKind::Value) return this->Val == TheAlias.Val;
+    if (this->Kind == AliasKind::Argument) return this->Arg == TheAlias.Arg;
+    if (this->Kind == AliasKind::Orig) return this->Base == TheAlias.Base;
+    return this->NameId == TheAlias.NameId;
 }
 
 void Alias::operator=(const Alias& TheAlias) {
-    unsigned int Kind = TheAlias.Kind;
-    if (Kind == 0) {
-        set(TheAlias.Val, TheAlias.Kind, TheAlias.Index, TheAlias.Func);
-    } else if (Kind == 1) {
-        set(TheAlias.Ty, TheAlias.Kind, TheAlias.Index);
-    } else if (Kind == 2) {
-        set(TheAlias.Arg, TheAlias.Kind, TheAlias.Index, TheAlias.Func);
-    } else if (Kind == 3) {
-        set(TheAlias.name, TheAlias.Kind, TheAlias.Index, TheAlias.Func);
+    AliasKind Kind = TheAlias.Kind;
+    if (Kind == AliasKind::Value) {
+        set(TheAlias.Val, TheAlias.Kind, TheAlias.Field, TheAlias.Func);
+    } else if (Kind == AliasKind::Type) {
+        set(TheAlias.Ty, TheAlias.Kind, TheAlias.Field);
+    } else if (Kind == AliasKind::Argument) {
+        set(TheAlias.Arg, TheAlias.Kind, TheAlias.Field, TheAlias.Func);
+    } else if (Kind == AliasKind::Dummy) {
+        set(TheAlias.NameId, TheAlias.Kind, TheAlias.Field, TheAlias.Func);
+    } else if (Kind == AliasKind::Orig) {
+        set(TheAlias.Base, TheAlias.Kind, TheAlias.Field, TheAlias.Func);
+    } else if (Kind == AliasKind::Heap) {
+        set(TheAlias.Heap, TheAlias.Kind, TheAlias.Field);
     }
 }
 
@@ -0,0 +1,255 @@
+#include "AliasSet.h"
+#include "AliasToken.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/Support/MathExtras.h"
+#include "algorithm"
+
+namespace AliasUtil {
+
+constexpr unsigned AliasSet::SmallSize;
+
+AliasSet::AliasSet(const AliasTokens& Bank) : Bank(&Bank) {}
+
+/// grow - Turns a small set into a bitset
+void AliasSet::grow() {
+    Words.assign(Small.empty() ? 0 : Small.back() / 64 + 1, 0);
+    for (uint32_t ID : Small) Words[ID / 64] |= uint64_t(1) << (ID % 64);
+    Small.clear();
+    IsSmall = false;
+}
+
+/// shrink - Turns a bitset back into a small set once it holds half of
+/// SmallSize tokens, the margin keeps a set from switching on every insert
+void AliasSet::shrink() {
+    if (IsSmall || Count > SmallSize / 2) return;
+    for (uint32_t ID = findNext(0); ID != Alias::InvalidID;
+         ID = findNext(ID + 1))
+        Small.push_back(ID);
+    Words.clear();
+    IsSmall = true;
+}
+
+/// insertID - Adds the token with id \p ID, returns true if it was not in
+/// the set
+bool AliasSet::insertID(uint32_t ID) {
+    assert(ID != Alias::InvalidID && "Token is not from a bank");
+    if (IsSmall) {
+        auto Position = std::lower_bound(Small.begin(), Small.end(), ID);
+        if (Position != Small.end() && *Position == ID) return false;
+        if (Small.size() < SmallSize) {
+            Small.insert(Position, ID);
+            ++Count;
+            return true;
+        }
+        grow();
+    }
+    if (ID / 64 >= Words.size()) Words.resize(ID / 64 + 1, 0);
+    uint64_t Bit = uint64_t(1) << (ID % 64);
+    if (Words[ID / 64] & Bit) return false;
+    Words[ID / 64] |= Bit;
+    ++Count;
+    return true;
+}
+
+/// eraseID - Removes the token with id \p ID, returns true if it was in the
+/// set
+bool AliasSet::eraseID(uint32_t ID) {
+    if (IsSmall) {
+        auto Position = std::lower_bound(Small.begin(), Small.end(), ID);
+        if (Position == Small.end() || *Position != ID) return false;
+        Small.erase(Position);
+        --Count;
+        return true;
+    }
+    if (!contains(ID)) return false;
+    Words[ID / 64] &= ~(uint64_t(1) << (ID % 64));
+    --Count;
+    return true;
+}
+
+/// insert - Adds \p A to the set, returns true if it was not in the set
+bool AliasSet::insert(const Alias* A) { return insertID(A->getID()); }
+
+/// erase - Removes \p A from the set, returns true if it was in the set
+bool AliasSet::erase(const Alias* A) { return eraseID(A->getID()); }
+
+/// contains - Returns true if \p A is in the set
+bool AliasSet::contains(const Alias* A) const { return contains(A->getID()); }
+
+/// contains - Returns true if the token with id \p ID is in the set
+bool AliasSet::contains(uint32_t ID) const {
+    if (IsSmall) return std::binary_search(Small.begin(), Small.end(), ID);
+    return ID / 64 < Words.size() &&
+           (Words[ID / 64] >> (ID % 64) & uint64_t(1));
+}
+
+/// clear - Removes every token, the set becomes small
+void AliasSet::clear() {
+    Small.clear();
+    Words.clear();
+    IsSmall = true;
+    Count = 0;
+}
+
+/// unionWith - Adds the tokens of \p Other, returns true if a token was added
+bool AliasSet::unionWith(const AliasSet& Other) {
+    assert(Bank == Other.Bank && "Sets of different banks");
+    if (Other.IsSmall) {
+        bool Changed = false;
+        for (uint32_t ID : Other.Small) Changed |= insertID(ID);
+        return Changed;
+    }
+    if (IsSmall) grow();
+    if (Words.size() < Other.Words.size()) Words.resize(Other.Words.size(), 0);
+    // Branch free so that the loop is vectorized
+    size_t Added = 0;
+    for (size_t I = 0; I < Other.Words.size(); ++I) {
+        uint64_t Word = Words[I] | Other.Words[I];
+        Added += llvm::countPopulation(Word ^ Words[I]);
+        Words[I] = Word;
+    }
+    Count += Added;
+    return Added;
+}
+
+/// intersectWith - Removes the tokens which are not in \p Other, returns true
+/// if a token was removed
+bool AliasSet::intersectWith(const AliasSet& Other) {
+    assert(Bank == Other.Bank && "Sets of different banks");
+    size_t Before = Count;
+    if (IsSmall) {
+        llvm::erase_if(Small, [&](uint32_t ID) { return !Other.contains(ID); });
+        Count = Small.size();
+        return Count != Before;
+    }
+    if (Other.IsSmall) {
+        for (uint32_t ID : Other.Small)
+            if (contains(ID)) Small.push_back(ID);
+        Words.clear();
+        IsSmall = true;
+        Count = Small.size();
+        return Count != Before;
+    }
+    size_t Common = std::min(Words.size(), Other.Words.size());
+    size_t Removed = 0;
+    for (size_t I = 0; I < Common; ++I) {
+        uint64_t Word = Words[I] & Other.Words[I];
+        Removed += llvm::countPopulation(Word ^ Words[I]);
+        Words[I] = Word;
+    }
+    for (size_t I = Common; I < Words.size(); ++I)
+        Removed += llvm::countPopulation(Words[I]);
+    Words.resize(Common);
+    Count -= Removed;
+    shrink();
+    return Removed;
+}
+
+/// subtract - Removes the tokens of \p Other, returns true if a token was
+/// removed
+bool AliasSet::subtract(const AliasSet& Other) {
+    assert(Bank == Other.Bank && "Sets of different banks");
+    size_t Before = Count;
+    if (IsSmall) {
+        llvm::erase_if(Small, [&](uint32_t ID) { return Other.contains(ID); });
+        Count = Small.size();
+        return Count != Before;
+    }
+    if (Other.IsSmall) {
+        for (uint32_t ID : Other.Small) eraseID(ID);
+    } else {
+        size_t Common = std::min(Words.size(), Other.Words.size());
+        size_t Removed = 0;
+        for (size_t I = 0; I < Common; ++I) {
+            uint64_t Word = Words[I] & ~Other.Words[I];
+            Removed += llvm::countPopulation(Word ^ Words[I]);
+            Words[I] = Word;
+        }
+        Count -= Removed;
+    }
+    shrink();
+    return Count != Before;
+}
+
+/// size - Returns the number of tokens in the set
+size_t AliasSet::size() const { return Count; }
+
+/// empty - Returns true if the set has no token
+bool AliasSet::empty() const { return !Count; }
+
+/// isSmall - Returns true if the set is kept as a sorted array
+bool AliasSet::isSmall() const { return IsSmall; }
+
+/// findNext - Returns the smallest id of the set not below \p From,
+/// Alias::InvalidID if there is none
+uint32_t AliasSet::findNext(uint32_t From) const {
+    if (IsSmall) {
+        auto Position = std::lower_bound(Small.begin(), Small.end(), From);
+        return Position == Small.end() ? Alias::InvalidID : *Position;
+    }
+    size_t I = From / 64;
+    if (I >= Words.size()) return Alias::InvalidID;
+    uint64_t Word = Words[I] & (~uint64_t(0) << (From % 64));
+    while (!Word) {
+        if (++I == Words.size()) return Alias::InvalidID;
+        Word = Words[I];
+    }
+    return I * 64 + llvm::countTrailingZeros(Word);
+}
+
+AliasSet::iterator AliasSet::begin() const {
+    return iterator(this, findNext(0));
+}
+
+AliasSet::iterator AliasSet::end() const {
+    return iterator(this, Alias::InvalidID);
+}
+
+Alias* AliasSet::iterator::operator*() const { return Set->Bank->lookup(ID); }
+
+AliasSet::iterator& AliasSet::iterator::operator++() {
+    ID = Set->findNext(ID + 1);
+    return *this;
+}
+
+/// operator== - Returns true if both sets hold the same tokens, whatever
+/// their representation
+bool AliasSet::operator==(const AliasSet& Other) const {
+    if (Count != Other.Count) return false;
+    if (IsSmall && Other.IsSmall) return Small == Other.Small;
+    if (IsSmall || Other.IsSmall) {
+        const AliasSet& SmallSet = IsSmall ? *this : Other;
+        const AliasSet& Large = IsSmall ? Other : *this;
+        return llvm::all_of(SmallSet.Small,
+                            [&](uint32_t ID) { return Large.contains(ID); });
+    }
+    size_t Common = std::min(Words.size(), Other.Words.size());
+    return std::equal(Words.begin(), Words.begin() + Common,
+                      Other.Words.begin());
+}
+
+/// hash_value - Returns the hash of the ids of \p Set, equal sets have the
+/// same hash whatever their representation
+llvm::hash_code hash_value(const AliasSet& Set) {
+    llvm::hash_code Hash = llvm::hash_value(Set.Count);
+    for (uint32_t ID = Set.findNext(0); ID != Alias::InvalidID;
+         ID = Set.findNext(ID + 1))
+        Hash = llvm::hash_combine(Hash, ID);
+    return Hash;
+}
+
+/// intern - Returns the set of the pool equal to \p Set, a copy of \p Set is
+/// added to the pool if there is none
+const AliasSet* AliasSetPool::intern(const AliasSet& Set) {
+    llvm::SmallVector<const AliasSet*, 1>& Bucket = Buckets[hash_value(Set)];
+    for (const AliasSet* Interned : Bucket)
+        if (*Interned == Set) return Interned;
+    Sets.emplace_back(new AliasSet(Set));
+    Bucket.push_back(Sets.back().get());
+    return Bucket.back();
+}
+
+/// size - Returns the number of distinct sets of the pool
+size_t AliasSetPool::size() const { return Sets.size(); }
+
+}  // namespace AliasUtil
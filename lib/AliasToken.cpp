@@ -1,68 +1,531 @@
 #include "AliasToken.h"
+#include "TokenSnapshot.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/EndianStream.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/StringSaver.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/TimeProfiler.h"
+#include "llvm/Support/WithColor.h"
+#include "algorithm"
+#include "chrono"
+
+#define DEBUG_TYPE "alias-token"
+
+// Statistics are only counted when the library is built with
+// ALIASTOKEN_ENABLE_STATS, ALIASTOKEN_STAT(...) is empty otherwise
+#ifdef ALIASTOKEN_ENABLE_STATS
+#define ALIASTOKEN_STAT(...) __VA_ARGS__
+STATISTIC(NumTokens, "Number of alias tokens created");
+STATISTIC(NumHits, "Number of alias token requests answered from the bank");
+STATISTIC(NumMisses, "Number of alias token requests creating a token");
+STATISTIC(NumExtracted, "Number of instructions extracted into tokens");
+STATISTIC(NumEvicted, "Number of alias tokens evicted after IR changes");
+#else
+#define ALIASTOKEN_STAT(...)
+#endif
 
 namespace AliasUtil {
 
-/// isCached - Returns true if Alias \p A is already present in cache
-bool AliasTokens::isCached(Alias* A) {
-    std::string hash = A->getHash();
-    return (AliasBank.find(hash) != AliasBank.end());
+/// BankStats - Counters of an AliasTokens bank, relaxed atomics so that a
+/// concurrent bank can count without taking locks
+struct AliasTokens::BankStats {
+    std::atomic<uint64_t> Hits[NumLookups];
+    std::atomic<uint64_t> Misses[NumLookups];
+    std::atomic<uint64_t> Allocations;
+    std::atomic<uint64_t> Frees;
+    // Indexed by opcode, extractions through extractTokens(Instruction*)
+    std::atomic<uint64_t> Extracted[llvm::Instruction::OtherOpsEnd];
+    std::atomic<uint64_t> ExtractNanos[llvm::Instruction::OtherOpsEnd];
+};
+
+#ifdef ALIASTOKEN_ENABLE_STATS
+namespace {
+/// ExtractTimer - Counts an extraction of an instruction with opcode
+/// \p Opcode and its duration when it goes out of scope
+class ExtractTimer {
+   private:
+    std::atomic<uint64_t>& Count;
+    std::atomic<uint64_t>& Nanos;
+    std::chrono::steady_clock::time_point Start;
+
+   public:
+    ExtractTimer(std::atomic<uint64_t>& Count, std::atomic<uint64_t>& Nanos)
+        : Count(Count), Nanos(Nanos), Start(std::chrono::steady_clock::now()) {}
+    ~ExtractTimer() {
+        auto Elapsed = std::chrono::steady_clock::now() - Start;
+        Count.fetch_add(1, std::memory_order_relaxed);
+        Nanos.fetch_add(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(Elapsed)
+                .count(),
+            std::memory_order_relaxed);
+        ++NumExtracted;
+    }
+};
+}  // namespace
+#endif
+
+static const char* LookupNames[] = {"value", "argument", "type",
+                                    "instruction", "alias", "dummy",
+                                    "field", "snapshot", "orig", "merge",
+                                    "heap"};
+static const char* KindNames[] = {"value", "type", "argument", "dummy",
+                                  "orig", "heap"};
+
+static llvm::cl::opt<unsigned> PrintUnsupported(
+    "alias-token-print-unsupported", llvm::cl::init(0),
+    llvm::cl::desc("Print up to N instructions AliasTokens can not abstract, "
+                   "and their count per opcode when a bank is destroyed"));
+
+static llvm::cl::opt<HeapAbstraction> DefaultHeapMode(
+    "alias-token-heap", llvm::cl::init(HeapAbstraction::Type),
+    llvm::cl::desc("Default heap abstraction of AliasTokens banks"),
+    llvm::cl::values(
+        clEnumValN(HeapAbstraction::Type, "type",
+                   "One heap token per allocated type"),
+        clEnumValN(HeapAbstraction::Site, "site",
+                   "One heap token per allocation site"),
+        clEnumValN(HeapAbstraction::CallString, "callstring",
+                   "One heap token per allocation site and k-limited call "
+                   "string given to getHeapToken, site tokens for "
+                   "extraction")),
+    // Extraction has no calling context, the call strings only reach the
+    // heap tokens requested by the client
+    llvm::cl::callback([](const HeapAbstraction& Mode) {
+        if (Mode == HeapAbstraction::CallString)
+            llvm::WithColor::warning()
+                << "-alias-token-heap=callstring only applies to the heap "
+                   "tokens requested with a call string, extraction and "
+                   "AliasTokenAnalysis get one heap token per site\n";
+    }));
+static llvm::cl::opt<unsigned> DefaultHeapDepth(
+    "alias-token-heap-k", llvm::cl::init(1),
+    llvm::cl::desc("Call sites kept in the calling context of heap tokens "
+                   "with -alias-token-heap=callstring, given to "
+                   "getHeapToken"));
+static llvm::cl::opt<unsigned> DefaultMaxHeapTokens(
+    "alias-token-heap-cap", llvm::cl::init(0),
+    llvm::cl::desc("Heap tokens a bank creates before falling back to "
+                   "coarser heap tokens, 0 for no limit"));
+
+constexpr unsigned AliasTokens::ConcurrentShards;
+
+namespace {
+/// getScope - Returns the function an entity is local to, nullptr for
+/// entities shared by the module
+const llvm::Function* getScope(llvm::Type*) { return nullptr; }
+
+const llvm::Function* getScope(llvm::Argument* Arg) { return Arg->getParent(); }
+
+const llvm::Function* getScope(llvm::Instruction* Inst) {
+    return Inst->getFunction();
 }
 
-/// insert - Returns true after inserting the Alias \p A in cache, retuns false
-/// if it is already present
-bool AliasTokens::insert(Alias* A) {
-    if (isCached(A)) {
-        delete A;
+const llvm::Function* getScope(llvm::Value* Val) {
+    if (llvm::Instruction* Inst = llvm::dyn_cast<llvm::Instruction>(Val))
+        return getScope(Inst);
+    if (llvm::Argument* Arg = llvm::dyn_cast<llvm::Argument>(Val))
+        return getScope(Arg);
+    return nullptr;
+}
+
+/// isNew - Returns true if \p Call is a direct call of operator new, the only
+/// allocation of HeapAbstraction::Type extraction
+bool isNew(const llvm::CallBase* Call) {
+    if (!llvm::isa<llvm::CallInst>(Call) || !Call->getCalledFunction())
         return false;
+    llvm::StringRef Name = Call->getCalledFunction()->getName();
+    return Name.startswith("_Zn") || Name.startswith("_zn");
+}
+
+/// getAllocatedType - Returns the type the result of \p Call is cast to by a
+/// BitCastInst, the type of the result if it is not cast
+llvm::Type* getAllocatedType(llvm::CallBase* Call) {
+    for (llvm::User* U : Call->users())
+        if (llvm::BitCastInst* Cast = llvm::dyn_cast<llvm::BitCastInst>(U))
+            return Cast->getDestTy();
+    return Call->getType();
+}
+}  // namespace
+
+/// AliasTokens - Creates an empty bank with the options \p Flags. Pass
+/// BankFlags::Concurrent to allow getAliasToken and extractAliasToken to be
+/// called from several threads.
+///
+/// Pass BankFlags::FunctionScoped to keep the tokens local to a function,
+/// its instructions, arguments, their fields and the dummy tokens of the
+/// function, apart from the tokens shared by the module so that
+/// releaseFunction can free them.
+///
+/// Pass BankFlags::Tracking to watch the values the tokens are derived from,
+/// the tokens of a deleted value are evicted and the tokens of a replaced
+/// value are remapped to its replacement, see compact.
+///
+/// The heap abstraction of the bank is given by the -alias-token-heap options
+/// until setHeapAbstraction is called
+AliasTokens::AliasTokens(BankFlags Flags)
+    : Concurrent(static_cast<bool>(Flags & BankFlags::Concurrent)),
+      NumShards(Concurrent ? ConcurrentShards : 1),
+      Shards(new Shard[NumShards]),
+      FunctionScoped(static_cast<bool>(Flags & BankFlags::FunctionScoped)),
+      Tracking(static_cast<bool>(Flags & BankFlags::Tracking)),
+      HeapMode(DefaultHeapMode),
+      HeapDepth(DefaultHeapDepth),
+      MaxHeapTokens(DefaultMaxHeapTokens) {
+    for (std::atomic<unsigned>& Count : Unsupported) Count = 0;
+    ALIASTOKEN_STAT(Stats.reset(new BankStats()));
+}
+
+/// lock - Returns a guard holding \p M if the bank is concurrent, an empty
+/// guard otherwise
+std::unique_lock<std::mutex> AliasTokens::lock(std::mutex& M) const {
+    if (Concurrent) return std::unique_lock<std::mutex>(M);
+    return std::unique_lock<std::mutex>(M, std::defer_lock);
+}
+
+/// getShard - Returns the shard owning tokens of the entity \p Ptr local to
+/// function \p Scope, nullptr for an entity shared by the module
+AliasTokens::Shard& AliasTokens::getShard(const void* Ptr,
+                                          const llvm::Function* Scope) {
+    if (Scope && FunctionScoped) return getFunctionShard(Scope);
+    if (NumShards == 1) return Shards[0];
+    return Shards[llvm::DenseMapInfo<const void*>::getHashValue(Ptr) %
+                  NumShards];
+}
+
+/// getFunctionShard - Returns the shard owning the tokens local to \p F,
+/// creates it on the first request
+AliasTokens::Shard& AliasTokens::getFunctionShard(const llvm::Function* F) {
+    auto Guard = lock(FunctionBanksLock);
+    std::unique_ptr<Shard>& Bank = FunctionBanks[F];
+    if (!Bank) Bank.reset(new Shard());
+    return *Bank;
+}
+
+/// releaseFunction - Frees the tokens local to \p F of a function scoped bank
+/// and the heap tokens allocated or called through \p F, and returns their
+/// number, 0 for other banks. The released tokens and their ids must not be
+/// used anymore, lookup returns nullptr for them, and tokens of \p F
+/// requested later are new tokens with new ids. Must not be called while
+/// other threads request tokens of \p F or heap tokens
+size_t AliasTokens::releaseFunction(const llvm::Function* F) {
+    if (!FunctionScoped) return 0;
+    size_t NumHeap = evictHeapContexts([F](const llvm::Instruction* Site) {
+        return Site->getFunction() == F;
+    });
+    std::unique_ptr<Shard> Bank;
+    {
+        auto Guard = lock(FunctionBanksLock);
+        auto Found = FunctionBanks.find(F);
+        if (Found == FunctionBanks.end()) return NumHeap;
+        Bank = std::move(Found->second);
+        FunctionBanks.erase(Found);
+    }
+    if (Tracking)
+        for (auto& Entry : Bank->AliasBank) untrack(Entry.second);
+    {
+        auto Guard = lock(TokensLock);
+        for (auto& Entry : Bank->AliasBank) {
+            uint32_t ID = Entry.second->ID;
+            Tokens[ID] = nullptr;
+            if (ID < Origs.size()) Origs[ID] = nullptr;
+        }
+        NumReleased += Bank->AliasBank.size();
+    }
+    {
+        // Cached results of F point to the released tokens
+        auto Guard = lock(CacheLock);
+        auto HandlesGuard = lock(HandlesLock);
+        for (const llvm::Instruction& Inst : llvm::instructions(F)) {
+            ExtractionCache.erase(&Inst);
+            CacheHandles.erase(&Inst);
+        }
+        for (const llvm::Argument& Arg : F->args()) CacheHandles.erase(&Arg);
+    }
+    return Bank->AliasBank.size() + NumHeap;
+}
+
+/// compact - Reclaims the slots of the tokens released or evicted so far and
+/// returns the number of reclaimed ids. The ids of the remaining tokens are
+/// renumbered densely in the same order, their addresses do not change. The
+/// memory of evicted tokens is reused for new tokens and the shards of
+/// functions without tokens are freed, so released and evicted tokens must
+/// not be used anymore. Must not be called while other threads use the bank
+size_t AliasTokens::compact() {
+    size_t Reclaimed;
+    {
+        auto Guard = lock(TokensLock);
+        std::vector<Alias*> Live;
+        std::vector<Alias*> LiveOrigs;
+        Live.reserve(Tokens.size() - NumReleased);
+        LiveOrigs.reserve(Tokens.size() - NumReleased);
+        for (uint32_t ID = 0; ID < Tokens.size(); ++ID) {
+            Alias* A = Tokens[ID];
+            if (!A) continue;
+            A->ID = Live.size();
+            Live.push_back(A);
+            LiveOrigs.push_back(ID < Origs.size() ? Origs[ID] : nullptr);
+        }
+        Reclaimed = Tokens.size() - Live.size();
+        Tokens.swap(Live);
+        Origs.swap(LiveOrigs);
+        NumReleased = 0;
+    }
+    auto reuse = [](Shard& S) {
+        S.FreeList.insert(S.FreeList.end(), S.Evicted.begin(),
+                          S.Evicted.end());
+        S.Evicted.clear();
+    };
+    for (unsigned I = 0; I < NumShards; ++I) reuse(Shards[I]);
+    auto Guard = lock(FunctionBanksLock);
+    for (auto It = FunctionBanks.begin(); It != FunctionBanks.end();) {
+        auto Current = It++;
+        if (Current->second->AliasBank.empty())
+            FunctionBanks.erase(Current);
+        else
+            reuse(*Current->second);
+    }
+    return Reclaimed;
+}
+
+/// getKey - Returns the structural key of Alias \p A used to index the bank
+AliasKey AliasTokens::getKey(const Alias* A) {
+    return {A->entity(), A->Func, A->Field, A->Kind};
+}
+
+/// getCanonical - Returns the token in shard \p S equivalent to \p Probe, a
+/// copy of \p Probe is allocated in the arena if the bank has none. The lock
+/// of \p S must be held, \p Via is only used for statistics
+Alias* AliasTokens::getCanonical(Shard& S, Alias& Probe, Lookup Via) {
+    // Via is only counted in statistics builds
+    (void)Via;
+    auto Inserted = S.AliasBank.try_emplace(getKey(&Probe), nullptr);
+    if (Inserted.second) {
+        Alias* A;
+        if (S.FreeList.empty()) {
+            A = new (S.Arena.Allocate<Alias>()) Alias(&Probe);
+        } else {
+            A = new (S.FreeList.back()) Alias(&Probe);
+            S.FreeList.pop_back();
+        }
+        {
+            auto Guard = lock(TokensLock);
+            A->ID = Tokens.size();
+            Tokens.push_back(A);
+        }
+        Inserted.first->second = A;
+        if (Probe.Kind == AliasKind::Heap) ++NumHeapTokens;
+        if (Tracking) track(A);
+        ALIASTOKEN_STAT(++NumTokens; ++NumMisses;
+                        Stats->Misses[unsigned(Via)]++; Stats->Allocations++);
     } else {
-        std::string hash = A->getHash();
-        AliasBank[hash] = A;
-        return true;
+        ALIASTOKEN_STAT(++NumHits; Stats->Hits[unsigned(Via)]++);
     }
+    return Inserted.first->second;
+}
+
+/// getCanonical - Returns the token in the bank equivalent to \p Probe
+Alias* AliasTokens::getCanonical(Alias& Probe, Lookup Via) {
+    Shard& S = getShard(Probe.entity(), Probe.Func);
+    auto Guard = lock(S.Lock);
+    return getCanonical(S, Probe, Via);
+}
+
+/// lookup - Returns the token with id \p ID, nullptr if it was released
+Alias* AliasTokens::lookup(uint32_t ID) const {
+    auto Guard = lock(TokensLock);
+    assert(ID < Tokens.size() && "Token id is not from this bank");
+    return Tokens[ID];
+}
+
+/// tokens - Returns every token of the bank in the order of their ids, the
+/// result must not be used while other threads add tokens. Released tokens
+/// are nullptr
+llvm::ArrayRef<Alias*> AliasTokens::tokens() const { return Tokens; }
+
+/// getTypeName - Returns the printed name of Type \p Ty, the type is only
+/// printed the first time its name is requested from the bank
+llvm::StringRef AliasTokens::getTypeName(llvm::Type* Ty) {
+    auto Guard = lock(TypeNameLock);
+    auto Inserted = TypeNames.try_emplace(Ty);
+    if (Inserted.second) {
+        std::string Name;
+        llvm::raw_string_ostream RSO(Name);
+        Ty->print(RSO);
+        Inserted.first->second =
+            llvm::StringSaver(TypeNameArena).save(RSO.str());
+    }
+    return Inserted.first->second;
+}
+
+/// getMemTypeName - Returns the memory type name of \p A like
+/// Alias::getMemTypeName, printed once per type for the bank
+llvm::StringRef AliasTokens::getMemTypeName(const Alias* A) {
+    if (!A->isMem()) return "";
+    return getTypeName(A->isHeap() ? A->Heap->getType() : A->Ty);
+}
+
+/// getFieldPath - Returns the path \p Parent extended by \p Index, the path is
+/// added to the trie if it does not exist
+const FieldPath* AliasTokens::getFieldPath(const FieldPath* Parent,
+                                           int64_t Index) {
+    auto Guard = lock(FieldLock);
+    auto Inserted = FieldPaths.try_emplace({Parent, Index}, nullptr);
+    if (Inserted.second) {
+        Inserted.first->second =
+            new (FieldArena.Allocate<FieldPath>()) FieldPath(Parent, Index);
+        ALIASTOKEN_STAT(Stats->Allocations++);
+    }
+    return Inserted.first->second;
+}
+
+/// importField - Returns the path of this bank with the same indices as
+/// \p Field of the trie of another bank
+const FieldPath* AliasTokens::importField(const FieldPath* Field) {
+    if (!Field) return nullptr;
+    return getFieldPath(importField(Field->getParent()), Field->getIndex());
+}
+
+/// getHeapContext - Returns the context \p Parent extended by the call site
+/// \p Site, or the allocation site \p Site of objects of type \p Ty if
+/// \p Parent is nullptr. The context is added to the trie if it does not
+/// exist and \p Create is true, a site keeps the type of its first request.
+/// Returns nullptr for a missing context which is not created
+const HeapContext* AliasTokens::getHeapContext(const HeapContext* Parent,
+                                               llvm::Instruction* Site,
+                                               llvm::Type* Ty, bool Create) {
+    auto Guard = lock(HeapLock);
+    if (!Create) {
+        auto It = HeapContexts.find({Parent, Site});
+        return It == HeapContexts.end() ? nullptr : It->second;
+    }
+    auto Inserted = HeapContexts.try_emplace({Parent, Site}, nullptr);
+    if (Inserted.second) {
+        Inserted.first->second = new (HeapArena.Allocate<HeapContext>())
+            HeapContext(Parent, Site, Parent ? nullptr : Ty);
+        if (Tracking) {
+            auto HandlesGuard = lock(HandlesLock);
+            HeapSites.try_emplace(Site, Site, this);
+        }
+        ALIASTOKEN_STAT(Stats->Allocations++);
+    }
+    return Inserted.first->second;
+}
+
+/// evictHeapContexts - Drops the allocation contexts through a site for which
+/// \p Dead is true, along with the contexts extending them, and evicts their
+/// heap tokens. Returns the number of evicted tokens. Must not be called
+/// while other threads request heap tokens
+size_t AliasTokens::evictHeapContexts(
+    llvm::function_ref<bool(const llvm::Instruction*)> Dead) {
+    llvm::SmallPtrSet<const HeapContext*, 8> Dropped;
+    {
+        auto Guard = lock(HeapLock);
+        llvm::SmallPtrSet<const llvm::Instruction*, 8> DeadSites;
+        for (auto It = HeapContexts.begin(); It != HeapContexts.end();) {
+            auto Current = It++;
+            for (const HeapContext* C = Current->second; C;
+                 C = C->getParent()) {
+                if (!Dead(C->getSite())) continue;
+                DeadSites.insert(C->getSite());
+                Dropped.insert(Current->second);
+                HeapContexts.erase(Current);
+                break;
+            }
+        }
+        auto HandlesGuard = lock(HandlesLock);
+        for (const llvm::Instruction* Site : DeadSites) HeapSites.erase(Site);
+    }
+    if (Dropped.empty()) return 0;
+    // Heap tokens are shared by the module, they are never in the shard of
+    // a function
+    size_t NumEvicted = 0;
+    for (unsigned I = 0; I < NumShards; ++I) {
+        Shard& S = Shards[I];
+        auto Guard = lock(S.Lock);
+        llvm::SmallVector<Alias*, 8> Evicted;
+        for (auto& Entry : S.AliasBank)
+            if (Entry.second->isHeap() && Dropped.count(Entry.second->Heap))
+                Evicted.push_back(Entry.second);
+        for (Alias* A : Evicted) {
+            unlink(S, A);
+            discard(S, A);
+        }
+        NumEvicted += Evicted.size();
+    }
+    NumHeapTokens -= NumEvicted;
+    return NumEvicted;
+}
+
+/// importHeap - Returns the context of this bank with the same sites as
+/// \p Heap of the trie of another bank
+const HeapContext* AliasTokens::importHeap(const HeapContext* Heap) {
+    if (!Heap) return nullptr;
+    return getHeapContext(importHeap(Heap->getParent()), Heap->getSite(),
+                          Heap->getType());
+}
+
+/// getEntityToken - Returns the token without field index for \p Entity,
+/// allocates a new Alias object only when it is not already in the bank
+template <typename EntityTy>
+Alias* AliasTokens::getEntityToken(EntityTy* Entity, Lookup Via) {
+    Shard& S = getShard(Entity, FunctionScoped ? getScope(Entity) : nullptr);
+    auto Guard = lock(S.Lock);
+    auto Cached = S.EntityIndex.find(Entity);
+    if (Cached != S.EntityIndex.end()) {
+        ALIASTOKEN_STAT(++NumHits; Stats->Hits[unsigned(Via)]++);
+        return Cached->second;
+    }
+    Alias Probe(Entity);
+    Alias* A = getCanonical(S, Probe, Via);
+    S.EntityIndex[Entity] = A;
+    return A;
+}
+
+/// bindToken - Returns the token in the bank equivalent to \p Base with the
+/// field path \p Field, used to bind the tokens of a snapshot
+Alias* AliasTokens::bindToken(Alias& Base, const FieldPath* Field) {
+    Base.Field = Field;
+    return getCanonical(Base, Lookup::Snapshot);
 }
 
 /// getAliasToken - Returns Alias object for Value \p Val, returns the object
 /// from cache if it already exists
 Alias* AliasTokens::getAliasToken(llvm::Value* Val) {
-    Alias* A = new Alias(Val);
-    std::string hash = A->getHash();
-    if (insert(A)) return A;
-    return AliasBank[hash];
+    return this->getEntityToken(Val, Lookup::Value);
 }
 
 /// getAliasToken - Returns Alias object for Argument \p Arg, returns the object
 /// from cache if it already exists
 Alias* AliasTokens::getAliasToken(llvm::Argument* Arg) {
-    Alias* A = new Alias(Arg);
-    std::string hash = A->getHash();
-    if (insert(A)) return A;
-    return AliasBank[hash];
+    return this->getEntityToken(Arg, Lookup::Argument);
 }
 
 /// getAliasToken - Returns Alias object for Type \p Ty, returns the object from
 /// cache if it already exists
 Alias* AliasTokens::getAliasToken(llvm::Type* Ty) {
-    Alias* A = new Alias(Ty);
-    std::string hash = A->getHash();
-    if (insert(A)) return A;
-    return AliasBank[hash];
+    return this->getEntityToken(Ty, Lookup::Type);
 }
 
 /// getAliasToken - Returns Alias object for Instruction \p Inst, returns the
 /// object from cache if it already exists
 Alias* AliasTokens::getAliasToken(llvm::Instruction* Inst) {
-    Alias* A = new Alias(Inst);
-    std::string hash = A->getHash();
-    if (insert(A)) return A;
-    return AliasBank[hash];
+    return this->getEntityToken(Inst, Lookup::Instruction);
 }
 
 /// getAliasToken - Returns Alias object from another alias object \p A, returns
-/// the object from cache if it already exists
+/// the object from cache if it already exists. The bank takes the ownership of
+/// the heap allocated \p A and deletes it, the returned object must be used
+/// instead
 Alias* AliasTokens::getAliasToken(Alias* A) {
-    std::string hash = A->getHash();
-    if (insert(A)) return A;
-    return AliasBank[hash];
+    Alias* Canonical = getCanonical(*A, Lookup::Alias);
+    delete A;
+    ALIASTOKEN_STAT(Stats->Frees++);
+    return Canonical;
 }
 
 /// getAliasToken - Returns Alias object for String \p S, returns the object
@@ -72,59 +535,218 @@ Alias* AliasTokens::getAliasToken(Alias* A) {
 /// \Func is the function associated with the alias object, pass nullptr if the
 /// dummy oject at a global scope
 Alias* AliasTokens::getAliasToken(std::string S, llvm::Function* Func) {
-    Alias* A = new Alias(S, Func);
-    std::string hash = A->getHash();
-    if (insert(A)) return A;
-    return AliasBank[hash];
+    Alias Probe(S, Func);
+    return getCanonical(Probe, Lookup::Dummy);
 }
 
-/// extractAliasToken - Returns a vector of alias objects derived from
-/// Instruction \Inst operands
-std::vector<Alias*> AliasTokens::extractAliasToken(llvm::Instruction* Inst) {
-    if (llvm::StoreInst* SI = llvm::dyn_cast<llvm::StoreInst>(Inst)) {
-        return extractAliasToken(SI);
-    } else if (llvm::LoadInst* LI = llvm::dyn_cast<llvm::LoadInst>(Inst)) {
-        return extractAliasToken(LI);
-    } else if (llvm::AllocaInst* AI = llvm::dyn_cast<llvm::AllocaInst>(Inst)) {
-        return extractAliasToken(AI);
-    } else if (llvm::BitCastInst* BI =
-                   llvm::dyn_cast<llvm::BitCastInst>(Inst)) {
-        return extractAliasToken(BI);
-    } else if (llvm::ReturnInst* RI = llvm::dyn_cast<llvm::ReturnInst>(Inst)) {
-        return extractAliasToken(RI);
-    } else if (llvm::GetElementPtrInst* GEP =
-                   llvm::dyn_cast<llvm::GetElementPtrInst>(Inst)) {
-        return extractAliasToken(GEP);
-    } else if (llvm::CallInst* CI = llvm::dyn_cast<llvm::CallInst>(Inst)) {
-        return extractAliasToken(CI);
-    } else {
-        // Direct support to some instructions may not be useful example
-        // CallInst, as it is more useful to generate alias object for call
-        // arguments on the fly
-        llvm::errs() << "[TODO]: Unsupported Instruction " << *Inst << "\n";
+/// getOrig - Returns the orig token standing for the location allocated for
+/// token \p Base of the bank, like the memory of an alloca, a global variable
+/// or the object an argument points to. The token is created on the first
+/// request and linked from the id of \p Base, dummy tokens are never
+/// equivalent to it
+Alias* AliasTokens::getOrig(Alias* Base) {
+    assert(Base->ID != Alias::InvalidID && "Token is not from this bank");
+    assert(!Base->isOrig() && "Orig tokens have no orig token");
+    {
+        auto Guard = lock(TokensLock);
+        if (Base->ID < Origs.size() && Origs[Base->ID]) {
+            ALIASTOKEN_STAT(++NumHits;
+                            Stats->Hits[unsigned(Lookup::Orig)]++);
+            return Origs[Base->ID];
+        }
+    }
+    Alias Probe(Base);
+    Probe.set(Base, AliasKind::Orig, nullptr, Base->Func);
+    Alias* Orig = getCanonical(Probe, Lookup::Orig);
+    auto Guard = lock(TokensLock);
+    if (Base->ID >= Origs.size()) Origs.resize(Tokens.size(), nullptr);
+    Origs[Base->ID] = Orig;
+    return Orig;
+}
+
+/// getHeapToken - Returns the heap token of the objects of type \p Ty
+/// allocated at \p Site in the calling context \p CallString, innermost call
+/// first. Following the heap abstraction of the bank this is the token of
+/// \p Ty, of \p Site, or of \p Site and the first K call sites of
+/// \p CallString.
+///
+/// Once the bank created its maximum number of heap tokens, new contexts fall
+/// back to the existing token of a shorter call string, then of the site
+/// alone and finally to the token of \p Ty. The contexts are then only looked
+/// up, so the trie does not grow past the maximum either. Concurrent threads
+/// may create a few tokens past the maximum
+Alias* AliasTokens::getHeapToken(llvm::CallBase* Site, llvm::Type* Ty,
+                                 llvm::ArrayRef<llvm::CallBase*> CallString) {
+    if (HeapMode == HeapAbstraction::Type) return getAliasToken(Ty);
+    if (HeapMode == HeapAbstraction::Site) CallString = {};
+    CallString = CallString.take_front(HeapDepth);
+    while (true) {
+        bool Create = !MaxHeapTokens || NumHeapTokens < MaxHeapTokens;
+        const HeapContext* Context = getHeapContext(nullptr, Site, Ty, Create);
+        for (llvm::CallBase* Call : CallString) {
+            if (!Context) break;
+            Context = getHeapContext(Context, Call, nullptr, Create);
+        }
+        if (Context) {
+            Alias Probe(Ty);
+            Probe.set(Context, AliasKind::Heap, nullptr);
+            Shard& S = getShard(Context, nullptr);
+            auto Guard = lock(S.Lock);
+            if (!MaxHeapTokens || NumHeapTokens < MaxHeapTokens ||
+                S.AliasBank.count(getKey(&Probe)))
+                return getCanonical(S, Probe, Lookup::Heap);
+        }
+        if (CallString.empty()) break;
+        CallString = CallString.drop_back();
+    }
+    return getAliasToken(Ty);
+}
+
+/// getAllocationToken - Returns the heap token of the objects allocated by
+/// \p Call in the calling context \p CallString, innermost call first, of
+/// the type its result is cast to. Returns nullptr if \p Call is not an
+/// allocation, see getHeapToken
+Alias* AliasTokens::getAllocationToken(
+    llvm::CallBase* Call, llvm::ArrayRef<llvm::CallBase*> CallString) {
+    if (!isAllocation(Call)) return nullptr;
+    return getHeapToken(Call, getAllocatedType(Call), CallString);
+}
+
+/// setHeapAbstraction - Sets the objects the heap tokens of the bank stand
+/// for to \p Mode, keeping \p K call sites of the calling context in
+/// HeapAbstraction::CallString. Pass \p MaxTokens to limit the number of heap
+/// tokens of the bank, see getHeapToken, 0 for no limit. Must be called
+/// before the first heap token is requested
+void AliasTokens::setHeapAbstraction(HeapAbstraction Mode, unsigned K,
+                                     size_t MaxTokens) {
+    assert(!NumHeapTokens && "Heap tokens were already requested");
+    HeapMode = Mode;
+    HeapDepth = K;
+    MaxHeapTokens = MaxTokens;
+}
+
+/// getHeapAbstraction - Returns the objects the heap tokens stand for
+HeapAbstraction AliasTokens::getHeapAbstraction() const { return HeapMode; }
+
+/// isAllocation - Returns true if \p Call allocates objects on the heap, a
+/// call of operator new, malloc, calloc or realloc
+bool AliasTokens::isAllocation(const llvm::CallBase* Call) {
+    const llvm::Function* Callee = Call->getCalledFunction();
+    if (!Callee) return false;
+    llvm::StringRef Name = Callee->getName();
+    return Name.startswith("_Zn") || Name.startswith("_zn") ||
+           Name == "malloc" || Name == "calloc" || Name == "realloc";
+}
+
+/// isSupported - Returns true if extractTokens abstracts instructions of the
+/// class of \p Inst
+bool AliasTokens::isSupported(const llvm::Instruction* Inst) {
+    switch (Inst->getOpcode()) {
+        case llvm::Instruction::Store:
+        case llvm::Instruction::Load:
+        case llvm::Instruction::Alloca:
+        case llvm::Instruction::BitCast:
+        case llvm::Instruction::Ret:
+        case llvm::Instruction::GetElementPtr:
+        case llvm::Instruction::Call:
+        case llvm::Instruction::PHI:
+        case llvm::Instruction::Select:
+        case llvm::Instruction::Invoke:
+        case llvm::Instruction::AtomicCmpXchg:
+        case llvm::Instruction::AtomicRMW:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/// extractTokens - Returns the alias objects derived from Instruction \Inst
+/// operands, without heap allocation when there are at most two of them
+ExtractedTokens AliasTokens::extractTokens(llvm::Instruction* Inst) {
+    ALIASTOKEN_STAT(ExtractTimer Timer(Stats->Extracted[Inst->getOpcode()],
+                                       Stats->ExtractNanos[Inst->getOpcode()]));
+    switch (Inst->getOpcode()) {
+        case llvm::Instruction::Store:
+            return extractTokens(llvm::cast<llvm::StoreInst>(Inst));
+        case llvm::Instruction::Load:
+            return extractTokens(llvm::cast<llvm::LoadInst>(Inst));
+        case llvm::Instruction::Alloca:
+            return extractTokens(llvm::cast<llvm::AllocaInst>(Inst));
+        case llvm::Instruction::BitCast:
+            return extractTokens(llvm::cast<llvm::BitCastInst>(Inst));
+        case llvm::Instruction::Ret:
+            return extractTokens(llvm::cast<llvm::ReturnInst>(Inst));
+        case llvm::Instruction::GetElementPtr:
+            return extractTokens(llvm::cast<llvm::GetElementPtrInst>(Inst));
+        case llvm::Instruction::Call:
+            if (llvm::MemTransferInst* MT =
+                    llvm::dyn_cast<llvm::MemTransferInst>(Inst))
+                return extractTokens(MT);
+            return extractTokens(llvm::cast<llvm::CallInst>(Inst));
+        case llvm::Instruction::PHI:
+            return extractTokens(llvm::cast<llvm::PHINode>(Inst));
+        case llvm::Instruction::Select:
+            return extractTokens(llvm::cast<llvm::SelectInst>(Inst));
+        case llvm::Instruction::Invoke:
+            return extractTokens(llvm::cast<llvm::InvokeInst>(Inst));
+        case llvm::Instruction::AtomicCmpXchg:
+            return extractTokens(llvm::cast<llvm::AtomicCmpXchgInst>(Inst));
+        case llvm::Instruction::AtomicRMW:
+            return extractTokens(llvm::cast<llvm::AtomicRMWInst>(Inst));
+        default:
+            // Direct support to some instructions may not be useful example
+            // CallInst, as it is more useful to generate alias object for
+            // call arguments on the fly
+            reportUnsupported(Inst);
     }
     return {};
 }
 
-/// extractAliasToken - Returns a vector of alias objects derived from
-/// Global variable \Global operands
-std::vector<Alias*> AliasTokens::extractAliasToken(
-    llvm::GlobalVariable* Global) {
-    std::vector<Alias*> AliasVec;
+/// reportUnsupported - Counts \p Inst as an instruction extractTokens can not
+/// abstract, only the first -alias-token-print-unsupported instructions are
+/// printed, see printUnsupported for the summary
+void AliasTokens::reportUnsupported(llvm::Instruction* Inst) {
+    Unsupported[Inst->getOpcode()].fetch_add(1, std::memory_order_relaxed);
+    if (!PrintUnsupported) return;
+    if (Printed.fetch_add(1, std::memory_order_relaxed) < PrintUnsupported)
+        llvm::errs() << "[TODO]: Unsupported Instruction " << *Inst << "\n";
+}
+
+/// printUnsupported - Prints the number of instructions of each opcode
+/// extractTokens could not abstract on a single line, prints nothing if every
+/// instruction was supported
+void AliasTokens::printUnsupported(llvm::raw_ostream& OS) const {
+    bool Any = false;
+    for (unsigned Opcode = 0; Opcode < llvm::Instruction::OtherOpsEnd;
+         ++Opcode) {
+        unsigned Count = Unsupported[Opcode].load(std::memory_order_relaxed);
+        if (!Count) continue;
+        if (!Any) OS << "[TODO]: Unsupported Instructions:";
+        Any = true;
+        OS << " " << llvm::Instruction::getOpcodeName(Opcode) << " x" << Count;
+    }
+    if (Any) OS << "\n";
+}
+
+/// extractTokens - Returns the alias objects derived from Global variable
+/// \Global operands
+ExtractedTokens AliasTokens::extractTokens(llvm::GlobalVariable* Global) {
+    ExtractedTokens AliasVec(
+        StatementTraits<llvm::GlobalVariable>::getStatementType());
     if (Global->hasName() && !Global->getName().startswith("_")) {
-        AliasVec.push_back(this->getAliasToken(Global));
-        AliasVec.push_back(
-            this->getAliasToken(Global->getName().str() + "-orig", nullptr));
+        Alias* GlobalAlias = this->getAliasToken(Global);
+        AliasVec.push_back(GlobalAlias);
+        AliasVec.push_back(this->getOrig(GlobalAlias));
     }
     return AliasVec;
 }
 
-/// extractAliasToken - Returns a vector of alias objects for StoreInst \Inst
-/// operands.
-std::vector<Alias*> AliasTokens::extractAliasToken(llvm::StoreInst* Inst) {
+/// extractTokens - Returns the alias objects for StoreInst \Inst operands.
+ExtractedTokens AliasTokens::extractTokens(llvm::StoreInst* Inst) {
     // The operands are returned in the same order as they are present in the
     // instruction example store op1 op2
-    std::vector<Alias*> AliasVec;
+    ExtractedTokens AliasVec(
+        StatementTraits<llvm::StoreInst>::getStatementType());
     AliasVec.push_back(this->getAliasToken(Inst->getPointerOperand()));
     llvm::Value* ValOp = Inst->getValueOperand();
     if (!llvm::isa<llvm::ConstantInt>(ValOp))
@@ -132,54 +754,55 @@ std::vector<Alias*> AliasTokens::extractAliasToken(llvm::StoreInst* Inst) {
     return AliasVec;
 }
 
-/// extractAliasToken - Returns a vector of alias objects for StoreInst \Inst
-/// operands.
-std::vector<Alias*> AliasTokens::extractAliasToken(llvm::LoadInst* Inst) {
+/// extractTokens - Returns the alias objects for LoadInst \Inst operands.
+ExtractedTokens AliasTokens::extractTokens(llvm::LoadInst* Inst) {
     // The operands are returned in the same order as they are present in the
     // instruction example x = load op1
-    std::vector<Alias*> AliasVec;
+    ExtractedTokens AliasVec(
+        StatementTraits<llvm::LoadInst>::getStatementType());
     AliasVec.push_back(this->getAliasToken(Inst));
     AliasVec.push_back(this->getAliasToken(Inst->getPointerOperand()));
     return AliasVec;
 }
 
-/// extractAliasToken - Returns a vector of alias objects for AllocaInst \Inst
-/// operands.
-std::vector<Alias*> AliasTokens::extractAliasToken(llvm::AllocaInst* Inst) {
+/// extractTokens - Returns the alias objects for AllocaInst \Inst operands.
+ExtractedTokens AliasTokens::extractTokens(llvm::AllocaInst* Inst) {
     // The operands are returned in the same order as they are present in the
     // instruction example x = alloca op1
-    std::vector<Alias*> AliasVec;
+    ExtractedTokens AliasVec(
+        StatementTraits<llvm::AllocaInst>::getStatementType());
     Alias* Alloca = this->getAliasToken(Inst);
     AliasVec.push_back(Alloca);
-    AliasVec.push_back(this->getAliasToken(Alloca->getName().str() + "-orig",
-                                           Inst->getParent()->getParent()));
+    AliasVec.push_back(this->getOrig(Alloca));
     return AliasVec;
 }
 
-/// extractAliasToken - Returns a vector of alias objects for ReturnInst \Inst
-/// operands.
-std::vector<Alias*> AliasTokens::extractAliasToken(llvm::ReturnInst* Inst) {
+/// extractTokens - Returns the alias objects for ReturnInst \Inst operands.
+ExtractedTokens AliasTokens::extractTokens(llvm::ReturnInst* Inst) {
     // The operands are returned in the same order as they are present in the
     // instruction example return op1
-    std::vector<Alias*> AliasVec;
+    ExtractedTokens AliasVec(
+        StatementTraits<llvm::ReturnInst>::getStatementType());
     llvm::Value* RetVal = Inst->getReturnValue();
     if (RetVal && !llvm::isa<llvm::ConstantInt>(RetVal))
         AliasVec.push_back(this->getAliasToken(RetVal));
     return AliasVec;
 }
 
-/// extractAliasToken - Returns a vector of alias objects for BitCastInst \Inst
-/// operands.
-std::vector<Alias*> AliasTokens::extractAliasToken(llvm::BitCastInst* Inst) {
+/// extractTokens - Returns the alias objects for BitCastInst \Inst operands,
+/// the cast of an allocation gives its heap token. The heap token of a type
+/// only stands for the objects of operator new
+ExtractedTokens AliasTokens::extractTokens(llvm::BitCastInst* Inst) {
     // The operands are returned in the same order as they are present in the
     // instruction example x = bitcast op1
-    std::vector<Alias*> AliasVec;
+    ExtractedTokens AliasVec(
+        StatementTraits<llvm::BitCastInst>::getStatementType());
     AliasVec.push_back(this->getAliasToken(Inst));
-    if (llvm::CallInst* CI =
-            llvm::dyn_cast<llvm::CallInst>(Inst->getOperand(0))) {
-        if (CI->getCalledFunction()->getName().startswith("_Zn") ||
-            CI->getCalledFunction()->getName().startswith("_zn"))
-            AliasVec.push_back(this->getAliasToken(Inst->getDestTy()));
+    if (llvm::CallBase* Call =
+            llvm::dyn_cast<llvm::CallBase>(Inst->getOperand(0))) {
+        if (HeapMode == HeapAbstraction::Type ? isNew(Call)
+                                              : isAllocation(Call))
+            AliasVec.push_back(this->getHeapToken(Call, Inst->getDestTy()));
     } else if (llvm::BitCastInst* BI =
                    llvm::dyn_cast<llvm::BitCastInst>(Inst->getOperand(0))) {
         AliasVec.push_back(this->getAliasToken(BI->getDestTy()));
@@ -190,75 +813,1008 @@ std::vector<Alias*> AliasTokens::extractAliasToken(llvm::BitCastInst* Inst) {
     return AliasVec;
 }
 
-/// extractAliasToken - Returns a vector of alias objects for GetElementPointer
-/// \Inst operands.
-std::vector<Alias*> AliasTokens::extractAliasToken(
-    llvm::GetElementPtrInst* Inst) {
+/// extractTokens - Returns the alias objects for GetElementPointer \Inst
+/// operands.
+ExtractedTokens AliasTokens::extractTokens(llvm::GetElementPtrInst* Inst) {
     // Only provides partial support and returns {op1, op2} for op1 = GEP op2
     // idx1 idx2
-    std::vector<Alias*> AliasVec;
+    ExtractedTokens AliasVec(
+        StatementTraits<llvm::GetElementPtrInst>::getStatementType());
     AliasVec.push_back(this->getAliasToken(Inst));
     AliasVec.push_back(this->getAliasToken(Inst->getPointerOperand()));
     return AliasVec;
 }
 
-/// extractAliasToken - Returns a vector of alias objects for Argument \Arg of
-/// Function \Func
-std::vector<Alias*> AliasTokens::extractAliasToken(llvm::Argument* Arg,
-                                                   llvm::Function* Func) {
-    std::vector<Alias*> AliasVec;
+/// extractTokens - Returns the alias objects for Argument \Arg, the function
+/// is the parent of \Arg and is not needed
+ExtractedTokens AliasTokens::extractTokens(llvm::Argument* Arg,
+                                           llvm::Function*) {
+    ExtractedTokens AliasVec(
+        StatementTraits<llvm::Argument>::getStatementType());
     Alias* ArgAlias = this->getAliasToken(Arg);
     AliasVec.push_back(ArgAlias);
-    AliasVec.push_back(
-        this->getAliasToken(Arg->getName().str() + "-orig", Func));
+    AliasVec.push_back(this->getOrig(ArgAlias));
     return AliasVec;
 }
 
-/// extractAliasToken - Returns the alias object for variable storing the
-/// return value from the function call
-std::vector<Alias*> AliasTokens::extractAliasToken(llvm::CallInst* CI) {
-    std::vector<Alias*> AliasVec;
+/// extractTokens - Returns the alias object for variable storing the return
+/// value from the function call
+ExtractedTokens AliasTokens::extractTokens(llvm::CallInst* CI) {
+    ExtractedTokens AliasVec(
+        StatementTraits<llvm::CallInst>::getStatementType());
     if (!CI->doesNotReturn()) {
         AliasVec.push_back(this->getAliasToken(CI));
     }
     return AliasVec;
 }
 
+/// extractTokens - Returns the alias objects for PHINode \Inst operands,
+/// incoming constants are skipped
+ExtractedTokens AliasTokens::extractTokens(llvm::PHINode* Inst) {
+    // The operands are returned in the same order as they are present in the
+    // instruction example x = phi op1 op2 ...
+    ExtractedTokens AliasVec(
+        StatementTraits<llvm::PHINode>::getStatementType());
+    AliasVec.push_back(this->getAliasToken(Inst));
+    for (llvm::Value* Incoming : Inst->incoming_values())
+        if (!llvm::isa<llvm::ConstantData>(Incoming))
+            AliasVec.push_back(this->getAliasToken(Incoming));
+    return AliasVec;
+}
+
+/// extractTokens - Returns the alias objects for SelectInst \Inst operands,
+/// constant operands are skipped
+ExtractedTokens AliasTokens::extractTokens(llvm::SelectInst* Inst) {
+    // The operands are returned in the same order as they are present in the
+    // instruction example x = select cond op1 op2
+    ExtractedTokens AliasVec(
+        StatementTraits<llvm::SelectInst>::getStatementType());
+    AliasVec.push_back(this->getAliasToken(Inst));
+    for (llvm::Value* Op : {Inst->getTrueValue(), Inst->getFalseValue()})
+        if (!llvm::isa<llvm::ConstantData>(Op))
+            AliasVec.push_back(this->getAliasToken(Op));
+    return AliasVec;
+}
+
+/// extractTokens - Returns the alias object for variable storing the return
+/// value from the invoked function
+ExtractedTokens AliasTokens::extractTokens(llvm::InvokeInst* Inst) {
+    ExtractedTokens AliasVec(
+        StatementTraits<llvm::InvokeInst>::getStatementType());
+    if (!Inst->doesNotReturn()) {
+        AliasVec.push_back(this->getAliasToken(Inst));
+    }
+    return AliasVec;
+}
+
+/// extractTokens - Returns the alias objects for the destination and source of
+/// memcpy and memmove \Inst, the copy is the statement *x = *y
+ExtractedTokens AliasTokens::extractTokens(llvm::MemTransferInst* Inst) {
+    ExtractedTokens AliasVec(
+        StatementTraits<llvm::MemTransferInst>::getStatementType());
+    AliasVec.push_back(this->getAliasToken(Inst->getRawDest()));
+    AliasVec.push_back(this->getAliasToken(Inst->getRawSource()));
+    return AliasVec;
+}
+
+/// extractTokens - Returns the alias objects for AtomicCmpXchgInst \Inst
+/// operands, the exchange may store the new value like store op2 op1
+ExtractedTokens AliasTokens::extractTokens(llvm::AtomicCmpXchgInst* Inst) {
+    // The operands are returned in the order of a store example
+    // cmpxchg op1 cmp op2 gives {op1, op2}
+    ExtractedTokens AliasVec(
+        StatementTraits<llvm::AtomicCmpXchgInst>::getStatementType());
+    AliasVec.push_back(this->getAliasToken(Inst->getPointerOperand()));
+    llvm::Value* NewVal = Inst->getNewValOperand();
+    if (!llvm::isa<llvm::ConstantData>(NewVal))
+        AliasVec.push_back(this->getAliasToken(NewVal));
+    return AliasVec;
+}
+
+/// extractTokens - Returns the alias objects for AtomicRMWInst \Inst operands,
+/// only an exchange stores its value operand unchanged
+ExtractedTokens AliasTokens::extractTokens(llvm::AtomicRMWInst* Inst) {
+    // The operands are returned in the order of a store example
+    // atomicrmw xchg op1 op2 gives {op1, op2}
+    ExtractedTokens AliasVec(
+        StatementTraits<llvm::AtomicRMWInst>::getStatementType());
+    AliasVec.push_back(this->getAliasToken(Inst->getPointerOperand()));
+    llvm::Value* Val = Inst->getValOperand();
+    if (Inst->getOperation() == llvm::AtomicRMWInst::Xchg &&
+        !llvm::isa<llvm::ConstantData>(Val))
+        AliasVec.push_back(this->getAliasToken(Val));
+    return AliasVec;
+}
+
+/// extractAliasToken - Returns a vector of alias objects derived from
+/// Instruction \Inst operands, see extractTokens
+std::vector<Alias*> AliasTokens::extractAliasToken(llvm::Instruction* Inst) {
+    return extractTokens(Inst).vec();
+}
+
+/// extractAliasToken - Returns a vector of alias objects for StoreInst \Inst
+std::vector<Alias*> AliasTokens::extractAliasToken(llvm::StoreInst* Inst) {
+    return extractTokens(Inst).vec();
+}
+
+/// extractAliasToken - Returns a vector of alias objects for LoadInst \Inst
+std::vector<Alias*> AliasTokens::extractAliasToken(llvm::LoadInst* Inst) {
+    return extractTokens(Inst).vec();
+}
+
+/// extractAliasToken - Returns a vector of alias objects for AllocaInst \Inst
+std::vector<Alias*> AliasTokens::extractAliasToken(llvm::AllocaInst* Inst) {
+    return extractTokens(Inst).vec();
+}
+
+/// extractAliasToken - Returns a vector of alias objects for BitCastInst \Inst
+std::vector<Alias*> AliasTokens::extractAliasToken(llvm::BitCastInst* Inst) {
+    return extractTokens(Inst).vec();
+}
+
+/// extractAliasToken - Returns a vector of alias objects for ReturnInst \Inst
+std::vector<Alias*> AliasTokens::extractAliasToken(llvm::ReturnInst* Inst) {
+    return extractTokens(Inst).vec();
+}
+
+/// extractAliasToken - Returns a vector of alias objects for GetElementPointer
+/// \Inst
+std::vector<Alias*> AliasTokens::extractAliasToken(
+    llvm::GetElementPtrInst* Inst) {
+    return extractTokens(Inst).vec();
+}
+
+/// extractAliasToken - Returns a vector of alias objects for Global variable
+/// \Global
+std::vector<Alias*> AliasTokens::extractAliasToken(
+    llvm::GlobalVariable* Global) {
+    return extractTokens(Global).vec();
+}
+
+/// extractAliasToken - Returns a vector of alias objects for CallInst \CI
+std::vector<Alias*> AliasTokens::extractAliasToken(llvm::CallInst* CI) {
+    return extractTokens(CI).vec();
+}
+
+/// extractAliasToken - Returns a vector of alias objects for Argument \Arg of
+/// Function \Func
+std::vector<Alias*> AliasTokens::extractAliasToken(llvm::Argument* Arg,
+                                                   llvm::Function* Func) {
+    return extractTokens(Arg, Func).vec();
+}
+
+/// extractModule - Returns the alias tokens of every global variable, and of
+/// every argument and instruction of the functions defined in \p M.
+///
+/// The entities are split into chunks of similar instruction count which are
+/// extracted on a pool of \p Threads threads, pass 0 to use every core. Idle
+/// threads pick up the next pending chunk so large functions do not serialize
+/// the extraction. A bank which is not concurrent extracts on the calling
+/// thread
+ModuleTokens AliasTokens::extractModule(llvm::Module& M, unsigned Threads) {
+    llvm::TimeTraceScope Scope("AliasTokens::extractModule",
+                               M.getModuleIdentifier());
+    std::vector<llvm::Value*> Items;
+    for (llvm::GlobalVariable& Global : M.globals()) Items.push_back(&Global);
+    for (llvm::Function& F : M) {
+        if (F.isDeclaration()) continue;
+        for (llvm::Argument& Arg : F.args()) Items.push_back(&Arg);
+        for (llvm::Instruction& Inst : llvm::instructions(F))
+            Items.push_back(&Inst);
+    }
+
+    if (!Concurrent) Threads = 1;
+    llvm::ThreadPoolStrategy Strategy = llvm::hardware_concurrency(Threads);
+    unsigned NumThreads = Strategy.compute_thread_count();
+    // Several chunks per thread keep the threads busy when chunks are uneven
+    size_t ChunkSize =
+        std::max<size_t>(256, Items.size() / (NumThreads * 16) + 1);
+    size_t NumChunks = (Items.size() + ChunkSize - 1) / ChunkSize;
+    std::vector<unsigned> Counts(Items.size());
+    std::vector<std::vector<Alias*>> ChunkTokens(NumChunks);
+
+    auto extractChunk = [&](size_t Chunk) {
+        size_t End = std::min(Items.size(), (Chunk + 1) * ChunkSize);
+        for (size_t I = Chunk * ChunkSize; I < End; ++I) {
+            ExtractedTokens AliasVec;
+            if (llvm::Instruction* Inst =
+                    llvm::dyn_cast<llvm::Instruction>(Items[I]))
+                AliasVec = extractTokens(Inst);
+            else if (llvm::Argument* Arg =
+                         llvm::dyn_cast<llvm::Argument>(Items[I]))
+                AliasVec = extractTokens(Arg, Arg->getParent());
+            else
+                AliasVec = extractTokens(
+                    llvm::cast<llvm::GlobalVariable>(Items[I]));
+            Counts[I] = AliasVec.size();
+            ChunkTokens[Chunk].insert(ChunkTokens[Chunk].end(),
+                                      AliasVec.begin(), AliasVec.end());
+        }
+    };
+    if (NumThreads <= 1 || NumChunks <= 1) {
+        for (size_t Chunk = 0; Chunk < NumChunks; ++Chunk)
+            extractChunk(Chunk);
+    } else {
+        llvm::ThreadPool Pool(Strategy);
+        for (size_t Chunk = 0; Chunk < NumChunks; ++Chunk)
+            Pool.async([&extractChunk, Chunk]() { extractChunk(Chunk); });
+        Pool.wait();
+    }
+
+    ModuleTokens Result;
+    Result.Entities.reserve(Items.size());
+    Result.Offsets.reserve(Items.size() + 1);
+    Result.Offsets.push_back(0);
+    for (size_t I = 0; I < Items.size(); ++I) {
+        Result.Entities[Items[I]] = I;
+        Result.Offsets.push_back(Result.Offsets.back() + Counts[I]);
+    }
+    Result.Storage.reserve(Result.Offsets.back());
+    for (std::vector<Alias*>& Tokens : ChunkTokens)
+        Result.Storage.insert(Result.Storage.end(), Tokens.begin(),
+                              Tokens.end());
+    return Result;
+}
+
+/// merge - Adds the tokens of \p Banks, built for separate modules, to this
+/// bank and returns the remapping of each of them in the same order, so
+/// that results computed over the ids of a bank can be combined without
+/// extracting the tokens again.
+///
+/// Tokens of globals with external linkage are unified by name along with
+/// their fields and orig tokens, the definition of a global stands for its
+/// declarations. Tokens local to a function, of globals with local linkage
+/// and of dummies of a function stay distinct; global dummy tokens are
+/// unified by name. The tokens of each bank are split into chunks merged on
+/// a pool of \p Threads threads, pass 0 to use every core, so the ids of
+/// this bank depend on the scheduling. A bank which is not concurrent merges
+/// on the calling thread. \p Banks must not change during the merge
+std::vector<AliasTokens::Remap> AliasTokens::merge(
+    llvm::ArrayRef<AliasTokens*> Banks, unsigned Threads) {
+    llvm::TimeTraceScope Scope("AliasTokens::merge");
+    // The token of a linked global is the token of the definition, chosen
+    // before merging so that it does not depend on the scheduling
+    llvm::StringMap<llvm::GlobalValue*> Linked;
+    for (AliasTokens* Bank : Banks) {
+        assert(Bank != this && "A bank can not be merged into itself");
+        for (Alias* A : Bank->Tokens) {
+            if (!A || A->Kind != AliasKind::Value) continue;
+            llvm::GlobalValue* Global =
+                llvm::dyn_cast<llvm::GlobalValue>(A->Val);
+            if (!Global || Global->hasLocalLinkage() || !Global->hasName())
+                continue;
+            auto Inserted = Linked.try_emplace(Global->getName(), Global);
+            if (!Inserted.second && Inserted.first->second->isDeclaration() &&
+                !Global->isDeclaration())
+                Inserted.first->second = Global;
+        }
+    }
+
+    std::vector<Remap> Remaps(Banks.size());
+    for (size_t I = 0; I < Banks.size(); ++I)
+        Remaps[I].assign(Banks[I]->Tokens.size(), nullptr);
+    auto mergeToken = [&](Alias* A, const Remap& Merged) -> Alias* {
+        if (A->isOrig()) {
+            Alias* Base = Merged[A->Base->ID];
+            if (!Base) return nullptr;
+            Alias* Orig = getOrig(Base);
+            if (!A->Field) return Orig;
+            Alias Probe(Orig);
+            Probe.Field = importField(A->Field);
+            return getCanonical(Probe, Lookup::Merge);
+        }
+        Alias Probe(A);
+        Probe.Field = importField(A->Field);
+        if (A->isHeap()) Probe.Heap = importHeap(A->Heap);
+        if (A->Kind == AliasKind::Value)
+            if (llvm::GlobalValue* Global =
+                    llvm::dyn_cast<llvm::GlobalValue>(A->Val))
+                if (!Global->hasLocalLinkage() && Global->hasName())
+                    Probe.Val = Linked.lookup(Global->getName());
+        return getCanonical(Probe, Lookup::Merge);
+    };
+
+    if (!Concurrent) Threads = 1;
+    llvm::ThreadPoolStrategy Strategy = llvm::hardware_concurrency(Threads);
+    unsigned NumThreads = Strategy.compute_thread_count();
+    size_t NumTokens = 0;
+    for (AliasTokens* Bank : Banks) NumTokens += Bank->Tokens.size();
+    size_t ChunkSize =
+        std::max<size_t>(1024, NumTokens / (NumThreads * 16) + 1);
+    // Chunks of the ids of a bank, identified by the bank and the first id
+    std::vector<std::pair<size_t, size_t>> Chunks;
+    for (size_t I = 0; I < Banks.size(); ++I)
+        for (size_t Begin = 0; Begin < Banks[I]->Tokens.size();
+             Begin += ChunkSize)
+            Chunks.push_back({I, Begin});
+    // Orig tokens are merged after the tokens of their base
+    auto mergeChunk = [&](size_t Chunk, bool OrigPhase) {
+        size_t I = Chunks[Chunk].first;
+        std::vector<Alias*>& Source = Banks[I]->Tokens;
+        size_t End = std::min(Source.size(), Chunks[Chunk].second + ChunkSize);
+        for (size_t ID = Chunks[Chunk].second; ID < End; ++ID)
+            if (Source[ID] && Source[ID]->isOrig() == OrigPhase)
+                Remaps[I][ID] = mergeToken(Source[ID], Remaps[I]);
+    };
+    for (bool OrigPhase : {false, true}) {
+        if (NumThreads <= 1 || Chunks.size() <= 1) {
+            for (size_t Chunk = 0; Chunk < Chunks.size(); ++Chunk)
+                mergeChunk(Chunk, OrigPhase);
+        } else {
+            llvm::ThreadPool Pool(Strategy);
+            for (size_t Chunk = 0; Chunk < Chunks.size(); ++Chunk)
+                Pool.async([&mergeChunk, Chunk, OrigPhase]() {
+                    mergeChunk(Chunk, OrigPhase);
+                });
+            Pool.wait();
+        }
+    }
+    return Remaps;
+}
+
+/// bindCalls - Returns the bindings of every call and invoke of the functions
+/// defined in \p M. A direct call is bound to its callee and an indirect
+/// call to each callee \p Resolve adds for it, indirect calls are skipped
+/// without a resolver and intrinsics are never bound.
+///
+/// Actual arguments which are constant data are skipped like in
+/// extractTokens, as are the actual arguments past the formal arguments of
+/// the callee. The returned tokens of a callee are the tokens extractTokens
+/// gives for its ReturnInsts, a call which does not return has none
+CallBindings AliasTokens::bindCalls(llvm::Module& M,
+                                    CallBindings::CalleeResolver Resolve) {
+    llvm::TimeTraceScope Scope("AliasTokens::bindCalls",
+                               M.getModuleIdentifier());
+    CallBindings Result;
+    // Returned tokens of each callee, extracted for its first call
+    llvm::DenseMap<const llvm::Function*, llvm::SmallVector<Alias*, 2>>
+        Returned;
+    auto getReturned = [&](llvm::Function* F) -> llvm::ArrayRef<Alias*> {
+        auto Inserted = Returned.try_emplace(F);
+        if (Inserted.second)
+            for (llvm::BasicBlock& BB : *F)
+                if (llvm::ReturnInst* Ret =
+                        llvm::dyn_cast<llvm::ReturnInst>(BB.getTerminator()))
+                    for (Alias* A : extractTokens(Ret))
+                        Inserted.first->second.push_back(A);
+        return Inserted.first->second;
+    };
+
+    llvm::SmallVector<llvm::Function*, 4> Callees;
+    for (llvm::Function& F : M) {
+        if (F.isDeclaration()) continue;
+        for (llvm::Instruction& Inst : llvm::instructions(F)) {
+            llvm::CallBase* Call = llvm::dyn_cast<llvm::CallBase>(&Inst);
+            if (!Call || llvm::isa<llvm::IntrinsicInst>(Call)) continue;
+            Callees.clear();
+            if (llvm::Function* Callee = Call->getCalledFunction())
+                Callees.push_back(Callee);
+            else if (Resolve)
+                Resolve(Call, Callees);
+            if (Callees.empty()) continue;
+            Result.Calls[Call] = {Result.Sites.size(), Callees.size()};
+            for (llvm::Function* Callee : Callees) {
+                CallBindings::Site S;
+                S.Call = Call;
+                S.Callee = Callee;
+                S.ArgBegin = Result.Arguments.size();
+                S.RetBegin = Result.Returns.size();
+                Result.Sites.push_back(S);
+                unsigned NumArgs =
+                    std::min<unsigned>(Call->arg_size(), Callee->arg_size());
+                for (unsigned I = 0; I < NumArgs; ++I) {
+                    llvm::Value* Actual = Call->getArgOperand(I);
+                    if (llvm::isa<llvm::ConstantData>(Actual)) continue;
+                    Alias* Formal = getAliasToken(Callee->getArg(I));
+                    Result.Arguments.push_back({getAliasToken(Actual), Formal});
+                }
+                if (Call->doesNotReturn() || Callee->isDeclaration()) continue;
+                for (Alias* Ret : getReturned(Callee))
+                    Result.Returns.push_back({Ret, getAliasToken(Call)});
+            }
+        }
+    }
+    CallBindings::Site Sentinel;
+    Sentinel.Call = nullptr;
+    Sentinel.Callee = nullptr;
+    Sentinel.ArgBegin = Result.Arguments.size();
+    Sentinel.RetBegin = Result.Returns.size();
+    Result.Sites.push_back(Sentinel);
+    return Result;
+}
+
+/// serialize - Writes the tokens of the bank for module \p M to \p OS as an
+/// image TokenSnapshot can map back. Instructions are referred to by their
+/// function name and position, globals by their name, and heap types by
+/// their printed name. Tokens of values which can not be referred to, like
+/// constant expressions, and released tokens keep their id but are not bound
+/// back. Must not be called while other threads add tokens
+void AliasTokens::serialize(llvm::raw_ostream& OS, const llvm::Module& M) {
+    using Snapshot = TokenSnapshot;
+    llvm::DenseMap<const llvm::Instruction*, uint32_t> InstIndex;
+    for (const llvm::Function& F : M) {
+        uint32_t Index = 0;
+        for (const llvm::Instruction& Inst : llvm::instructions(F))
+            InstIndex[&Inst] = Index++;
+    }
+
+    llvm::StringMap<uint32_t> StringIds;
+    std::vector<llvm::StringRef> Strings;
+    auto getStringId = [&](llvm::StringRef S) {
+        auto Inserted = StringIds.try_emplace(S, Strings.size());
+        if (Inserted.second) Strings.push_back(Inserted.first->getKey());
+        return Inserted.first->second;
+    };
+    // Nodes are numbered so that a parent comes before its children
+    llvm::DenseMap<const FieldPath*, uint32_t> FieldIds;
+    std::vector<Snapshot::FieldRecord> Fields;
+    auto getFieldId = [&](const FieldPath* Field) {
+        llvm::SmallVector<const FieldPath*, 8> Path;
+        for (; Field && !FieldIds.count(Field); Field = Field->getParent())
+            Path.push_back(Field);
+        uint32_t Id = Field ? FieldIds[Field] : Snapshot::None;
+        for (const FieldPath* Node : llvm::reverse(Path)) {
+            Snapshot::FieldRecord Record = {};
+            Record.Index = Node->getIndex();
+            Record.Parent = Id;
+            Id = FieldIds[Node] = Fields.size();
+            Fields.push_back(Record);
+        }
+        return Id;
+    };
+
+    std::vector<Snapshot::TokenRecord> Records(Tokens.size());
+    for (size_t ID = 0; ID < Tokens.size(); ++ID) {
+        const Alias* A = Tokens[ID];
+        Snapshot::TokenRecord& Record = Records[ID];
+        Record.Field = Snapshot::None;
+        Record.Func = Snapshot::None;
+        Record.Entity = Snapshot::None;
+        if (!A) continue;
+        Record.Kind = static_cast<uint8_t>(A->Kind);
+        Record.Field = getFieldId(A->Field);
+        bool Bindable = !A->Func || A->Func->hasName();
+        if (A->Func) Record.Func = getStringId(A->Func->getName());
+        switch (A->Kind) {
+            case AliasKind::Value:
+                if (A->Func) {
+                    auto Found = InstIndex.find(
+                        llvm::dyn_cast<llvm::Instruction>(A->Val));
+                    Bindable &= Found != InstIndex.end();
+                    if (Found != InstIndex.end()) Record.Entity = Found->second;
+                } else if (llvm::isa<llvm::GlobalValue>(A->Val) &&
+                           A->Val->hasName()) {
+                    Record.Entity = getStringId(A->Val->getName());
+                } else {
+                    Bindable = false;
+                }
+                break;
+            case AliasKind::Argument:
+                Record.Entity = A->Arg->getArgNo();
+                break;
+            case AliasKind::Type:
+                Record.Entity = getStringId(getTypeName(A->Ty));
+                break;
+            case AliasKind::Dummy:
+                Record.Entity = getStringId(A->getName());
+                break;
+            case AliasKind::Orig:
+                Record.Entity = A->Base->ID;
+                break;
+            case AliasKind::Heap:
+                // Allocation contexts are not written
+                Bindable = false;
+                break;
+        }
+        Record.Flags = Bindable ? Snapshot::Bindable : 0;
+    }
+
+    Snapshot::Header Head = {};
+    std::copy(std::begin(Snapshot::Magic), std::end(Snapshot::Magic),
+              Head.Magic);
+    Head.Version = Snapshot::Version;
+    Head.NumTokens = Records.size();
+    Head.ModuleHash = Snapshot::getModuleHash(M);
+    Head.NumFields = Fields.size();
+    Head.NumStrings = Strings.size();
+    uint32_t StringBytes = 0;
+    for (llvm::StringRef S : Strings) StringBytes += S.size();
+    Head.StringBytes = StringBytes;
+
+    auto write = [&OS](const void* Data, size_t Size) {
+        OS.write(static_cast<const char*>(Data), Size);
+    };
+    write(&Head, sizeof(Head));
+    write(Fields.data(), Fields.size() * sizeof(Snapshot::FieldRecord));
+    write(Records.data(), Records.size() * sizeof(Snapshot::TokenRecord));
+    llvm::support::endian::Writer Writer(OS, llvm::support::little);
+    uint32_t Offset = 0;
+    Writer.write<uint32_t>(Offset);
+    for (llvm::StringRef S : Strings) {
+        Offset += S.size();
+        Writer.write<uint32_t>(Offset);
+    }
+    for (llvm::StringRef S : Strings) OS << S;
+}
+
+AliasTokens::ExtractionHandle::ExtractionHandle(llvm::Value* V,
+                                               AliasTokens* Bank)
+    : llvm::CallbackVH(V), Bank(Bank) {}
+
+void AliasTokens::ExtractionHandle::deleted() {
+    // The handle itself is erased, nothing can be accessed after the call
+    Bank->invalidateCached(getValPtr());
+}
+
+void AliasTokens::ExtractionHandle::allUsesReplacedWith(llvm::Value*) {
+    Bank->invalidateCached(getValPtr());
+}
+
+AliasTokens::HeapSiteHandle::HeapSiteHandle(llvm::Value* V,
+                                             AliasTokens* Bank)
+    : llvm::CallbackVH(V), Bank(Bank) {}
+
+void AliasTokens::HeapSiteHandle::deleted() {
+    // The handle itself is erased, nothing can be accessed after the call
+    llvm::Value* V = getValPtr();
+    Bank->evictHeapContexts(
+        [V](const llvm::Instruction* Site) { return Site == V; });
+}
+
+AliasTokens::TokenHandle::TokenHandle(llvm::Value* V, AliasTokens* Bank)
+    : llvm::CallbackVH(V), Bank(Bank) {}
+
+void AliasTokens::TokenHandle::deleted() {
+    // The handle itself is erased, nothing can be accessed after the call
+    Bank->valueDeleted(getValPtr());
+}
+
+void AliasTokens::TokenHandle::allUsesReplacedWith(llvm::Value* New) {
+    Bank->valueReplaced(getValPtr(), New);
+}
+
+/// getRoot - Returns the value whose deletion evicts \p A, the entity of a
+/// value or argument token or of the base of an orig token, and the function
+/// of a dummy token. Returns nullptr for tokens living as long as the module
+/// and for heap tokens, which are evicted with the sites of their context
+llvm::Value* AliasTokens::getRoot(const Alias* A) {
+    switch (A->Kind) {
+        case AliasKind::Value:
+            return A->Val;
+        case AliasKind::Argument:
+            return A->Arg;
+        case AliasKind::Dummy:
+            return A->Func;
+        case AliasKind::Orig:
+            return getRoot(A->Base);
+        case AliasKind::Heap:
+        case AliasKind::Type:
+            break;
+    }
+    return nullptr;
+}
+
+/// track - Adds token \p A to the handle of the value it is derived from
+void AliasTokens::track(Alias* A) {
+    llvm::Value* Root = getRoot(A);
+    if (!Root) return;
+    auto Guard = lock(HandlesLock);
+    Handles.try_emplace(Root, Root, this).first->second.Tokens.push_back(A);
+}
+
+/// untrack - Removes token \p A from the handle of the value it is derived
+/// from, the handle is dropped with its last token
+void AliasTokens::untrack(Alias* A) {
+    llvm::Value* Root = getRoot(A);
+    if (!Root) return;
+    auto Guard = lock(HandlesLock);
+    auto Found = Handles.find(Root);
+    if (Found == Handles.end()) return;
+    llvm::SmallVector<Alias*, 2>& Tracked = Found->second.Tokens;
+    Tracked.erase(std::remove(Tracked.begin(), Tracked.end(), A),
+                  Tracked.end());
+    if (Tracked.empty()) Handles.erase(Found);
+}
+
+/// unlink - Removes token \p A from the indices of shard \p S, the lock of
+/// \p S must be held
+void AliasTokens::unlink(Shard& S, Alias* A) {
+    S.AliasBank.erase(getKey(A));
+    auto Entity = S.EntityIndex.find(A->entity());
+    if (Entity != S.EntityIndex.end() && Entity->second == A)
+        S.EntityIndex.erase(Entity);
+}
+
+/// discard - Evicts token \p A unlinked from shard \p S, its id maps to
+/// nullptr and its slot is reused after compact. The lock of \p S must be
+/// held
+void AliasTokens::discard(Shard& S, Alias* A) {
+    {
+        auto Guard = lock(TokensLock);
+        Tokens[A->ID] = nullptr;
+        if (A->ID < Origs.size()) Origs[A->ID] = nullptr;
+        if (A->isOrig() && A->Base->ID < Origs.size() &&
+            Origs[A->Base->ID] == A)
+            Origs[A->Base->ID] = nullptr;
+        ++NumReleased;
+    }
+    S.Evicted.push_back(A);
+    ALIASTOKEN_STAT(++NumEvicted);
+}
+
+/// valueDeleted - Evicts the tokens derived from the deleted value \p V, the
+/// tokens of its fields and its orig tokens, or the dummy tokens of a
+/// deleted function. \p V must not be accessed
+void AliasTokens::valueDeleted(llvm::Value* V) {
+    llvm::SmallVector<Alias*, 2> Evicted;
+    {
+        auto Guard = lock(HandlesLock);
+        auto Found = Handles.find(V);
+        if (Found == Handles.end()) return;
+        Evicted = std::move(Found->second.Tokens);
+        Handles.erase(Found);
+    }
+    for (Alias* A : Evicted) {
+        Shard& S = getShard(A->entity(), A->Func);
+        auto Guard = lock(S.Lock);
+        unlink(S, A);
+        discard(S, A);
+    }
+}
+
+/// valueReplaced - Remaps the tokens derived from \p Old to \p New in place,
+/// tokens keep their address and id. A token is evicted instead when the
+/// bank already has the token of \p New, or when it would move to another
+/// function of a function scoped bank, or when \p New is an instruction
+/// which is not in a block yet. Dummy tokens of a replaced function stay
+/// with it
+void AliasTokens::valueReplaced(llvm::Value* Old, llvm::Value* New) {
+    auto isDerived = [](const Alias* A) {
+        const Alias* Base = A->isOrig() ? A->Base : A;
+        return Base->Kind == AliasKind::Value ||
+               Base->Kind == AliasKind::Argument;
+    };
+    llvm::SmallVector<Alias*, 2> Moved;
+    {
+        auto Guard = lock(HandlesLock);
+        auto Found = Handles.find(Old);
+        if (Found == Handles.end()) return;
+        llvm::SmallVector<Alias*, 2>& Tracked = Found->second.Tokens;
+        llvm::copy_if(Tracked, std::back_inserter(Moved), isDerived);
+        llvm::erase_if(Tracked, isDerived);
+        if (Tracked.empty()) Handles.erase(Found);
+    }
+    // Orig tokens are keyed by their base, which is remapped first
+    std::stable_partition(Moved.begin(), Moved.end(),
+                          [](const Alias* A) { return !A->isOrig(); });
+    // The token of an instruction outside of a block has no function
+    llvm::Instruction* NewInst = llvm::dyn_cast<llvm::Instruction>(New);
+    bool Detached = NewInst && !NewInst->getParent();
+    for (Alias* A : Moved) {
+        Alias Probe(A);
+        bool Remapped =
+            !Detached && (!A->isOrig() || lookup(A->Base->ID) == A->Base);
+        if (Remapped) {
+            Probe = Alias(New);
+            Probe.Field = A->Field;
+            if (A->isOrig())
+                Probe.set(A->Base, AliasKind::Orig, A->Field, A->Base->Func);
+            Remapped = !(FunctionScoped && Probe.Func != A->Func);
+        }
+        Shard& From = getShard(A->entity(), A->Func);
+        {
+            auto Guard = lock(From.Lock);
+            unlink(From, A);
+            if (!Remapped) {
+                discard(From, A);
+                continue;
+            }
+        }
+        Shard& To = getShard(Probe.entity(), Probe.Func);
+        {
+            auto Guard = lock(To.Lock);
+            Remapped = To.AliasBank.try_emplace(getKey(&Probe), A).second;
+            if (Remapped) {
+                *A = Probe;
+                if (!A->Field && !A->isOrig())
+                    To.EntityIndex.try_emplace(A->entity(), A);
+            }
+        }
+        if (Remapped) {
+            track(A);
+        } else {
+            auto Guard = lock(From.Lock);
+            discard(From, A);
+        }
+    }
+}
+
+/// invalidateCached - Drops the cached results of \p V and of every
+/// instruction using \p V along with the handle watching \p V
+void AliasTokens::invalidateCached(llvm::Value* V) {
+    auto Guard = lock(CacheLock);
+    if (llvm::Instruction* Inst = llvm::dyn_cast<llvm::Instruction>(V))
+        ExtractionCache.erase(Inst);
+    for (llvm::User* U : V->users())
+        if (llvm::Instruction* UserInst = llvm::dyn_cast<llvm::Instruction>(U))
+            ExtractionCache.erase(UserInst);
+    auto HandlesGuard = lock(HandlesLock);
+    CacheHandles.erase(V);
+}
+
+/// extractCachedAliasToken - Returns the same tokens as extractAliasToken for
+/// \p Inst, memoized across calls. The result is invalidated when \p Inst or
+/// one of its operands is deleted or replaced through replaceAllUsesWith, an
+/// operand changed with setOperand is not tracked and needs
+/// clearExtractionCache. The returned tokens stay readable until the bank is
+/// destroyed
+llvm::ArrayRef<Alias*> AliasTokens::extractCachedAliasToken(
+    llvm::Instruction* Inst) {
+    {
+        auto Guard = lock(CacheLock);
+        auto Cached = ExtractionCache.find(Inst);
+        if (Cached != ExtractionCache.end()) return Cached->second;
+    }
+    ExtractedTokens AliasVec = extractTokens(Inst);
+    auto Guard = lock(CacheLock);
+    auto Inserted = ExtractionCache.try_emplace(Inst);
+    if (!Inserted.second) return Inserted.first->second;
+    Alias** Tokens = CacheArena.Allocate<Alias*>(AliasVec.size());
+    ALIASTOKEN_STAT(Stats->Allocations++);
+    std::copy(AliasVec.begin(), AliasVec.end(), Tokens);
+    Inserted.first->second = llvm::makeArrayRef(Tokens, AliasVec.size());
+    auto HandlesGuard = lock(HandlesLock);
+    CacheHandles.try_emplace(Inst, Inst, this);
+    for (llvm::Value* Op : Inst->operands())
+        if (!llvm::isa<llvm::ConstantData>(Op))
+            CacheHandles.try_emplace(Op, Op, this);
+    return Inserted.first->second;
+}
+
+/// clearExtractionCache - Drops every result of extractCachedAliasToken
+void AliasTokens::clearExtractionCache() {
+    auto Guard = lock(CacheLock);
+    ExtractionCache.clear();
+    auto HandlesGuard = lock(HandlesLock);
+    CacheHandles.clear();
+}
+
+StatementIterator::StatementIterator(AliasTokens* AT,
+                                     llvm::inst_iterator Begin,
+                                     llvm::inst_iterator End)
+    : AT(AT), Current(Begin), End(End) {
+    settle();
+}
+
+/// settle - Moves to the first instruction from the current one which is
+/// abstracted into tokens and extracts its first statement
+void StatementIterator::settle() {
+    RHSIndex = 0;
+    for (; Current != End; ++Current) {
+        llvm::Instruction* Inst = &*Current;
+        if (!AliasTokens::isSupported(Inst)) continue;
+        Tokens = AT->extractTokens(Inst);
+        if (Tokens.empty()) continue;
+        RHSIndex = Tokens.size() > 1 ? 1 : 0;
+        fill();
+        return;
+    }
+}
+
+/// fill - Sets the statement to the LHS of the current instruction and its
+/// RHS at RHSIndex
+void StatementIterator::fill() {
+    Stmt.Inst = &*Current;
+    Stmt.LHS = Tokens[0];
+    Stmt.RHS = RHSIndex ? Tokens[RHSIndex] : nullptr;
+    Stmt.LHSLevel = Tokens.LHSLevel;
+    Stmt.RHSLevel = Tokens.RHSLevel;
+}
+
+StatementIterator& StatementIterator::operator++() {
+    if (RHSIndex && RHSIndex + 1 < Tokens.size()) {
+        ++RHSIndex;
+        fill();
+        return *this;
+    }
+    ++Current;
+    settle();
+    return *this;
+}
+
+/// statements - Returns the statements of \p F in program order, instructions
+/// which are not abstracted into tokens are skipped
+llvm::iterator_range<StatementIterator> AliasTokens::statements(
+    llvm::Function& F) {
+    return {StatementIterator(this, llvm::inst_begin(F), llvm::inst_end(F)),
+            StatementIterator(this, llvm::inst_end(F), llvm::inst_end(F))};
+}
+
+/// forEachStatement - Calls \p Callback on the statements of \p F in program
+/// order
+void AliasTokens::forEachStatement(
+    llvm::Function& F, llvm::function_ref<void(const Statement&)> Callback) {
+    llvm::TimeTraceScope Scope("AliasTokens::forEachStatement", F.getName());
+    for (const Statement& Stmt : statements(F)) Callback(Stmt);
+}
+
 /// extractStatementType - Returns the relative level of redirection based of
-/// LHS and RHS on the statement
-template <typename Ty>
-std::pair<int, int> AliasTokens::extractStatementType(Ty* Inst) {
-    if (llvm::isa<llvm::AllocaInst>(Inst) ||
-        llvm::isa<llvm::GlobalVariable>(Inst) ||
-        llvm::isa<llvm::GetElementPtrInst>(Inst))
-        return {1, 0};
-    if (llvm::isa<llvm::StoreInst>(Inst)) return {2, 1};
-    if (llvm::isa<llvm::LoadInst>(Inst)) return {1, 2};
-    return {1, 1};
-}
-template std::pair<int, int>
-AliasTokens::extractStatementType<llvm::Instruction>(llvm::Instruction*);
-template std::pair<int, int>
-AliasTokens::extractStatementType<llvm::GlobalVariable>(llvm::GlobalVariable*);
-
-/// handleGEPUtil - Returns the extended field value for a GEP
+/// LHS and RHS on the statement, see StatementTraits
+template <>
+std::pair<int, int> AliasTokens::extractStatementType<llvm::Instruction>(
+    llvm::Instruction* Inst) {
+    switch (Inst->getOpcode()) {
+        case llvm::Instruction::Alloca:
+            return StatementTraits<llvm::AllocaInst>::getStatementType();
+        case llvm::Instruction::GetElementPtr:
+            return StatementTraits<llvm::GetElementPtrInst>::getStatementType();
+        case llvm::Instruction::Store:
+            return StatementTraits<llvm::StoreInst>::getStatementType();
+        case llvm::Instruction::Load:
+            return StatementTraits<llvm::LoadInst>::getStatementType();
+        case llvm::Instruction::Call:
+            if (llvm::isa<llvm::MemTransferInst>(Inst))
+                return StatementTraits<llvm::MemTransferInst>::
+                    getStatementType();
+            return StatementTraits<llvm::CallInst>::getStatementType();
+        case llvm::Instruction::AtomicCmpXchg:
+            return StatementTraits<llvm::AtomicCmpXchgInst>::getStatementType();
+        case llvm::Instruction::AtomicRMW:
+            return StatementTraits<llvm::AtomicRMWInst>::getStatementType();
+        default:
+            return StatementTraits<llvm::Instruction>::getStatementType();
+    }
+}
+
+/// extractStatementType - Returns the relative level of redirection based of
+/// LHS and RHS on the statement defining the global variable
+template <>
+std::pair<int, int> AliasTokens::extractStatementType<llvm::GlobalVariable>(
+    llvm::GlobalVariable*) {
+    return StatementTraits<llvm::GlobalVariable>::getStatementType();
+}
+
+/// handleGEPUtil - Returns the extended field value for a GEP, the field path
+/// of \p Ptr is extended by each index of \p G
 template <typename GEP>
 Alias* AliasTokens::handleGEPUtil(GEP* G, Alias* Ptr) {
     if (!Ptr) return Ptr;
-    Alias* FieldVal = new Alias(Ptr);
-    FieldVal->setIndex(G);
-    FieldVal = this->getAliasToken(FieldVal);
-    return FieldVal;
+    Alias FieldVal(Ptr);
+    for (auto Iter = G->idx_begin(); Iter != G->idx_end(); ++Iter) {
+        int64_t Index = FieldPath::Variable;
+        if (llvm::ConstantInt* CI = llvm::dyn_cast<llvm::ConstantInt>(*Iter))
+            if (CI->getBitWidth() <= 64) Index = CI->getSExtValue();
+        FieldVal.Field = getFieldPath(FieldVal.Field, Index);
+    }
+    return getCanonical(FieldVal, Lookup::Field);
 }
 template Alias* AliasTokens::handleGEPUtil<llvm::GetElementPtrInst>(
     llvm::GetElementPtrInst* G, Alias* Ptr);
 template Alias* AliasTokens::handleGEPUtil<llvm::GEPOperator>(
     llvm::GEPOperator* G, Alias* Ptr);
 
-AliasTokens::~AliasTokens() {
-    for (auto X : AliasBank) {
-        delete X.second;
+/// size - Returns the number of tokens in the bank, released tokens are not
+/// counted
+size_t AliasTokens::size() const {
+    auto Guard = lock(TokensLock);
+    return Tokens.size() - NumReleased;
+}
+
+/// getMemoryUsage - Returns the bytes held by the bank for its tokens and
+/// indices
+size_t AliasTokens::getMemoryUsage() const {
+    size_t Bytes = FieldArena.getTotalMemory() + FieldPaths.getMemorySize() +
+                   HeapArena.getTotalMemory() + HeapContexts.getMemorySize() +
+                   HeapSites.getMemorySize() +
+                   TypeNameArena.getTotalMemory() +
+                   TypeNames.getMemorySize() +
+                   (Tokens.capacity() + Origs.capacity()) * sizeof(Alias*) +
+                   Handles.getMemorySize();
+    auto getShardMemory = [](const Shard& S) {
+        return S.Arena.getTotalMemory() + S.AliasBank.getMemorySize() +
+               S.EntityIndex.getMemorySize() +
+               (S.Evicted.capacity() + S.FreeList.capacity()) * sizeof(Alias*);
+    };
+    for (unsigned I = 0; I < NumShards; ++I) Bytes += getShardMemory(Shards[I]);
+    auto Guard = lock(FunctionBanksLock);
+    Bytes += FunctionBanks.getMemorySize();
+    for (auto& Entry : FunctionBanks) Bytes += getShardMemory(*Entry.second);
+    return Bytes;
+}
+
+/// dumpStats - Prints the size of the bank, its tokens of each kind and the
+/// instructions it could not abstract to \p OS, as a JSON object if \p JSON
+/// is true. Request, allocation and extraction counters are only printed when
+/// the library is built with ALIASTOKEN_ENABLE_STATS
+void AliasTokens::dumpStats(llvm::raw_ostream& OS, bool JSON) const {
+    const unsigned NumKinds = llvm::array_lengthof(KindNames);
+    uint64_t Kinds[NumKinds] = {};
+    {
+        auto Guard = lock(TokensLock);
+        for (const Alias* A : Tokens)
+            if (A) ++Kinds[unsigned(A->getKind())];
+    }
+    auto load = [](const std::atomic<uint64_t>& Count) {
+        return Count.load(std::memory_order_relaxed);
+    };
+
+    if (!JSON) {
+        OS << "tokens: " << size() << "\n";
+        OS << "bytes: " << getMemoryUsage() << "\n";
+        for (unsigned Kind = 0; Kind < NumKinds; ++Kind)
+            OS << "tokens." << KindNames[Kind] << ": " << Kinds[Kind] << "\n";
+        for (unsigned Opcode = 0; Opcode < llvm::Instruction::OtherOpsEnd;
+             ++Opcode)
+            if (unsigned Count = Unsupported[Opcode])
+                OS << "unsupported." << llvm::Instruction::getOpcodeName(Opcode)
+                   << ": " << Count << "\n";
+        if (!Stats) {
+            OS << "counters: disabled, build with ALIASTOKEN_ENABLE_STATS\n";
+            return;
+        }
+        for (unsigned Via = 0; Via < NumLookups; ++Via)
+            OS << "lookup." << LookupNames[Via] << ": "
+               << load(Stats->Hits[Via]) << " hits, "
+               << load(Stats->Misses[Via]) << " misses\n";
+        OS << "allocations: " << load(Stats->Allocations) << "\n";
+        OS << "frees: " << load(Stats->Frees) << "\n";
+        for (unsigned Opcode = 0; Opcode < llvm::Instruction::OtherOpsEnd;
+             ++Opcode)
+            if (uint64_t Count = load(Stats->Extracted[Opcode]))
+                OS << "extract." << llvm::Instruction::getOpcodeName(Opcode)
+                   << ": " << Count << " calls, "
+                   << load(Stats->ExtractNanos[Opcode]) / Count << " ns/call\n";
+        return;
     }
+
+    llvm::json::OStream J(OS);
+    J.object([&]() {
+        J.attribute("tokens", int64_t(size()));
+        J.attribute("bytes", int64_t(getMemoryUsage()));
+        J.attributeObject("kinds", [&]() {
+            for (unsigned Kind = 0; Kind < NumKinds; ++Kind)
+                J.attribute(KindNames[Kind], int64_t(Kinds[Kind]));
+        });
+        J.attributeObject("unsupported", [&]() {
+            for (unsigned Opcode = 0; Opcode < llvm::Instruction::OtherOpsEnd;
+                 ++Opcode)
+                if (unsigned Count = Unsupported[Opcode])
+                    J.attribute(llvm::Instruction::getOpcodeName(Opcode),
+                                int64_t(Count));
+        });
+        J.attribute("counters", bool(Stats));
+        if (!Stats) return;
+        J.attributeObject("lookups", [&]() {
+            for (unsigned Via = 0; Via < NumLookups; ++Via)
+                J.attributeObject(LookupNames[Via], [&]() {
+                    J.attribute("hits", int64_t(load(Stats->Hits[Via])));
+                    J.attribute("misses", int64_t(load(Stats->Misses[Via])));
+                });
+        });
+        J.attribute("allocations", int64_t(load(Stats->Allocations)));
+        J.attribute("frees", int64_t(load(Stats->Frees)));
+        J.attributeObject("extract", [&]() {
+            for (unsigned Opcode = 0; Opcode < llvm::Instruction::OtherOpsEnd;
+                 ++Opcode) {
+                uint64_t Count = load(Stats->Extracted[Opcode]);
+                if (!Count) continue;
+                J.attributeObject(
+                    llvm::Instruction::getOpcodeName(Opcode), [&]() {
+                        J.attribute("calls", int64_t(Count));
+                        J.attribute("ns",
+                                    int64_t(load(Stats->ExtractNanos[Opcode])));
+                    });
+            }
+        });
+    });
+    OS << "\n";
+}
+
+/// ~AliasTokens - All tokens live in the arena and are released with its
+/// slabs, the instructions which could not be abstracted are summarized on
+/// stderr only with -alias-token-print-unsupported
+AliasTokens::~AliasTokens() {
+    if (PrintUnsupported) printUnsupported(llvm::errs());
 }
 
 }  // namespace AliasUtil
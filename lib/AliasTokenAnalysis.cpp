@@ -0,0 +1,109 @@
+#include "AliasTokenAnalysis.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Passes/PassPlugin.h"
+
+namespace AliasUtil {
+
+/// AliasTokenResult - Creates the bank of \p M and extracts the tokens of the
+/// module on \p Threads threads, see AliasTokens::extractModule
+AliasTokenResult::AliasTokenResult(llvm::Module& M, unsigned Threads)
+    : Bank(new AliasTokens(Threads != 1 ? BankFlags::Concurrent
+                                          : BankFlags::None)),
+      Tokens(Bank->extractModule(M, Threads)) {}
+
+/// getBank - Returns the bank of the module, tokens requested by a pass are
+/// shared with the passes run after it
+AliasTokens& AliasTokenResult::getBank() { return *Bank; }
+
+/// getModuleTokens - Returns the tokens extracted for every instruction,
+/// argument and global variable of the module
+const ModuleTokens& AliasTokenResult::getModuleTokens() const {
+    return Tokens;
+}
+
+/// get - Returns the tokens extracted for \p V, the same as
+/// extractAliasToken on the bank
+llvm::ArrayRef<Alias*> AliasTokenResult::get(const llvm::Value* V) const {
+    return Tokens.get(V);
+}
+
+/// invalidate - Returns true if the tokens must be extracted again, which is
+/// when a pass changing the module did not preserve AliasTokenAnalysis
+bool AliasTokenResult::invalidate(llvm::Module&,
+                                  const llvm::PreservedAnalyses& PA,
+                                  llvm::ModuleAnalysisManager::Invalidator&) {
+    auto Checker = PA.getChecker<AliasTokenAnalysis>();
+    return !Checker.preserved() &&
+           !Checker.preservedSet<llvm::AllAnalysesOn<llvm::Module>>();
+}
+
+llvm::AnalysisKey AliasTokenAnalysis::Key;
+
+/// AliasTokenAnalysis - Pass \p Threads other than 1 to extract the module on
+/// a concurrent bank, 0 uses every core
+AliasTokenAnalysis::AliasTokenAnalysis(unsigned Threads) : Threads(Threads) {}
+
+AliasTokenAnalysis::Result AliasTokenAnalysis::run(
+    llvm::Module& M, llvm::ModuleAnalysisManager&) {
+    return AliasTokenResult(M, Threads);
+}
+
+AliasTokenPrinterPass::AliasTokenPrinterPass(llvm::raw_ostream& OS)
+    : OS(OS) {}
+
+llvm::PreservedAnalyses AliasTokenPrinterPass::run(
+    llvm::Module& M, llvm::ModuleAnalysisManager& MAM) {
+    OS << "Alias tokens of module '" << M.getModuleIdentifier() << "':\n";
+    MAM.getResult<AliasTokenAnalysis>(M).getBank().dumpStats(OS);
+    return llvm::PreservedAnalyses::all();
+}
+
+char AliasTokenWrapperPass::ID = 0;
+
+AliasTokenWrapperPass::AliasTokenWrapperPass() : llvm::ModulePass(ID) {}
+
+/// getResult - Returns the bank and tokens of the module being run on
+AliasTokenResult& AliasTokenWrapperPass::getResult() { return *Result; }
+
+bool AliasTokenWrapperPass::runOnModule(llvm::Module& M) {
+    Result.reset(new AliasTokenResult(M, 1));
+    return false;
+}
+
+void AliasTokenWrapperPass::getAnalysisUsage(llvm::AnalysisUsage& AU) const {
+    AU.setPreservesAll();
+}
+
+void AliasTokenWrapperPass::releaseMemory() { Result.reset(); }
+
+void AliasTokenWrapperPass::print(llvm::raw_ostream& OS,
+                                  const llvm::Module*) const {
+    if (Result) Result->getBank().dumpStats(OS);
+}
+
+static llvm::RegisterPass<AliasTokenWrapperPass> X(
+    "alias-tokens", "Alias token bank of the module", false, true);
+
+}  // namespace AliasUtil
+
+/// llvmGetPassPluginInfo - Registers AliasTokenAnalysis and
+/// print<alias-tokens> when libAliasToken is loaded with -load-pass-plugin
+extern "C" llvm::PassPluginLibraryInfo
+llvmGetPassPluginInfo() {
+    return {LLVM_PLUGIN_API_VERSION, "AliasToken", "0.0.1",
+            [](llvm::PassBuilder& PB) {
+                PB.registerAnalysisRegistrationCallback(
+                    [](llvm::ModuleAnalysisManager& MAM) {
+                        MAM.registerPass(
+                            [] { return AliasUtil::AliasTokenAnalysis(); });
+                    });
+                PB.registerPipelineParsingCallback(
+                    [](llvm::StringRef Name, llvm::ModulePassManager& MPM,
+                       llvm::ArrayRef<llvm::PassBuilder::PipelineElement>) {
+                        if (Name != "print<alias-tokens>") return false;
+                        MPM.addPass(
+                            AliasUtil::AliasTokenPrinterPass(llvm::errs()));
+                        return true;
+                    });
+            }};
+}
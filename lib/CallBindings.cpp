@@ -0,0 +1,47 @@
+#include "CallBindings.h"
+
+namespace AliasUtil {
+
+/// sites - Returns every site of the module, the sites of a call are next to
+/// each other in the order of its callees
+llvm::ArrayRef<CallBindings::Site> CallBindings::sites() const {
+    if (Sites.empty()) return {};
+    return llvm::makeArrayRef(Sites).drop_back();
+}
+
+/// getSites - Returns the sites of \p Call, one per callee, empty if no
+/// callee is known
+llvm::ArrayRef<CallBindings::Site> CallBindings::getSites(
+    const llvm::CallBase* Call) const {
+    auto Found = Calls.find(Call);
+    if (Found == Calls.end()) return {};
+    return llvm::makeArrayRef(Sites).slice(Found->second.first,
+                                           Found->second.second);
+}
+
+/// getArguments - Returns the actual argument tokens of \p S bound to the
+/// formal argument tokens of its callee
+llvm::ArrayRef<CallBindings::Binding> CallBindings::getArguments(
+    const Site& S) const {
+    assert(&S >= Sites.data() && &S + 1 < Sites.data() + Sites.size() &&
+           "Site is not from these bindings");
+    const Site& Next = *(&S + 1);
+    return llvm::makeArrayRef(Arguments)
+        .slice(S.ArgBegin, Next.ArgBegin - S.ArgBegin);
+}
+
+/// getReturns - Returns the tokens returned by the callee of \p S bound to
+/// the token of the result of the call
+llvm::ArrayRef<CallBindings::Binding> CallBindings::getReturns(
+    const Site& S) const {
+    assert(&S >= Sites.data() && &S + 1 < Sites.data() + Sites.size() &&
+           "Site is not from these bindings");
+    const Site& Next = *(&S + 1);
+    return llvm::makeArrayRef(Returns).slice(S.RetBegin,
+                                             Next.RetBegin - S.RetBegin);
+}
+
+/// size - Returns the number of sites
+size_t CallBindings::size() const { return sites().size(); }
+
+}  // namespace AliasUtil
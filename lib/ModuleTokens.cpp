@@ -0,0 +1,23 @@
+#include "ModuleTokens.h"
+
+namespace AliasUtil {
+
+/// get - Returns the tokens extracted for the instruction, argument or global
+/// variable \p V, empty if \p V was not extracted
+llvm::ArrayRef<Alias*> ModuleTokens::get(const llvm::Value* V) const {
+    auto Entity = Entities.find(V);
+    if (Entity == Entities.end()) return {};
+    unsigned Begin = Offsets[Entity->second];
+    unsigned End = Offsets[Entity->second + 1];
+    return llvm::makeArrayRef(Storage).slice(Begin, End - Begin);
+}
+
+/// contains - Returns true if \p V was extracted
+bool ModuleTokens::contains(const llvm::Value* V) const {
+    return Entities.count(V);
+}
+
+/// size - Returns the number of extracted entities
+size_t ModuleTokens::size() const { return Entities.size(); }
+
+}  // namespace AliasUtil
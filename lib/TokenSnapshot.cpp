@@ -0,0 +1,204 @@
+#include "TokenSnapshot.h"
+#include "AliasToken.h"
+#include "llvm/AsmParser/Parser.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/Support/EndianStream.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/xxhash.h"
+#include "cstring"
+
+namespace AliasUtil {
+
+constexpr char TokenSnapshot::Magic[8];
+constexpr uint32_t TokenSnapshot::Version;
+constexpr uint32_t TokenSnapshot::None;
+constexpr uint8_t TokenSnapshot::Bindable;
+
+TokenSnapshot::TokenSnapshot(std::unique_ptr<llvm::MemoryBuffer> Buffer,
+                             llvm::Module& M, AliasTokens& Bank)
+    : Buffer(std::move(Buffer)), M(M), Bank(Bank) {}
+
+/// getModuleHash - Returns the hash of what a snapshot of \p M refers to, the
+/// names of its globals and functions, and the position, opcode and type of
+/// their instructions. The hash is stable across runs
+uint64_t TokenSnapshot::getModuleHash(const llvm::Module& M) {
+    std::string Data;
+    llvm::raw_string_ostream OS(Data);
+    llvm::support::endian::Writer Writer(OS, llvm::support::little);
+    for (const llvm::GlobalValue& Global : M.global_values())
+        OS << Global.getName() << '\0';
+    for (const llvm::Function& F : M) {
+        OS << F.getName() << '\0';
+        Writer.write<uint32_t>(F.arg_size());
+        for (const llvm::Instruction& Inst : llvm::instructions(F)) {
+            Writer.write<uint32_t>(Inst.getOpcode());
+            Writer.write<uint32_t>(Inst.getNumOperands());
+            Writer.write<uint32_t>(Inst.getType()->getTypeID());
+        }
+    }
+    return llvm::xxHash64(OS.str());
+}
+
+/// open - Maps the snapshot at \p Path written by AliasTokens::serialize for
+/// \p M, its tokens are bound to \p M and added to \p Bank on request
+llvm::Expected<std::unique_ptr<TokenSnapshot>> TokenSnapshot::open(
+    const llvm::Twine& Path, llvm::Module& M, AliasTokens& Bank) {
+    auto Buffer = llvm::MemoryBuffer::getFile(Path, /* IsText = */ false,
+                                              /* RequiresNullTerminator = */
+                                              false);
+    if (!Buffer) return llvm::errorCodeToError(Buffer.getError());
+    return load(std::move(*Buffer), M, Bank);
+}
+
+/// load - Reads the snapshot in \p Buffer written by AliasTokens::serialize
+/// for \p M, its tokens are bound to \p M and added to \p Bank on request
+llvm::Expected<std::unique_ptr<TokenSnapshot>> TokenSnapshot::load(
+    std::unique_ptr<llvm::MemoryBuffer> Buffer, llvm::Module& M,
+    AliasTokens& Bank) {
+    std::unique_ptr<TokenSnapshot> Snapshot(
+        new TokenSnapshot(std::move(Buffer), M, Bank));
+    if (llvm::Error E = Snapshot->validate()) return E;
+    return Snapshot;
+}
+
+/// validate - Checks the header and the layout of the image and locates its
+/// sections, token records are checked when they are bound
+llvm::Error TokenSnapshot::validate() {
+    auto error = [](const char* Message) {
+        return llvm::createStringError(llvm::inconvertibleErrorCode(),
+                                       Message);
+    };
+    llvm::StringRef Data = Buffer->getBuffer();
+    if (Data.size() < sizeof(Header)) return error("truncated token snapshot");
+    Head = reinterpret_cast<const Header*>(Data.data());
+    if (std::memcmp(Head->Magic, Magic, sizeof(Magic)))
+        return error("not an alias token snapshot");
+    if (Head->Version != Version)
+        return error("unsupported alias token snapshot version");
+
+    uint64_t Size = sizeof(Header) +
+                    uint64_t(Head->NumFields) * sizeof(FieldRecord) +
+                    uint64_t(Head->NumTokens) * sizeof(TokenRecord) +
+                    (uint64_t(Head->NumStrings) + 1) * sizeof(uint32_t) +
+                    Head->StringBytes;
+    if (Data.size() != Size) return error("truncated token snapshot");
+    Fields = reinterpret_cast<const FieldRecord*>(Head + 1);
+    Records = reinterpret_cast<const TokenRecord*>(Fields + Head->NumFields);
+    StringOffsets = reinterpret_cast<const llvm::support::ulittle32_t*>(
+        Records + Head->NumTokens);
+    Strings = reinterpret_cast<const char*>(StringOffsets + Head->NumStrings +
+                                            1);
+
+    for (uint32_t I = 0; I < Head->NumFields; ++I)
+        if (Fields[I].Parent != None && Fields[I].Parent >= I)
+            return error("malformed field paths in token snapshot");
+    for (uint32_t I = 0; I < Head->NumStrings; ++I)
+        if (StringOffsets[I] > StringOffsets[I + 1])
+            return error("malformed strings in token snapshot");
+    if (StringOffsets[Head->NumStrings] != Head->StringBytes)
+        return error("malformed strings in token snapshot");
+    if (Head->ModuleHash != getModuleHash(M))
+        return error("token snapshot is of a different module");
+
+    Bound.assign(Head->NumTokens, nullptr);
+    BoundFields.assign(Head->NumFields, nullptr);
+    BoundTypes.assign(Head->NumStrings, nullptr);
+    return llvm::Error::success();
+}
+
+/// size - Returns the number of tokens in the snapshot
+size_t TokenSnapshot::size() const { return Head->NumTokens; }
+
+/// getString - Returns the string \p Id of the string table
+llvm::StringRef TokenSnapshot::getString(uint32_t Id) const {
+    if (Id >= Head->NumStrings) return "";
+    return llvm::StringRef(Strings + StringOffsets[Id],
+                           StringOffsets[Id + 1] - StringOffsets[Id]);
+}
+
+/// getFunction - Returns the function named by string \p Id, nullptr if the
+/// module has none
+llvm::Function* TokenSnapshot::getFunction(uint32_t Id) {
+    if (Id == None) return nullptr;
+    return M.getFunction(getString(Id));
+}
+
+/// getField - Returns the field path of node \p Id in the trie of the bank
+const FieldPath* TokenSnapshot::getField(uint32_t Id) {
+    if (Id == None) return nullptr;
+    if (!BoundFields[Id])
+        BoundFields[Id] =
+            Bank.getFieldPath(getField(Fields[Id].Parent), Fields[Id].Index);
+    return BoundFields[Id];
+}
+
+/// getType - Returns the type printed as string \p Id, the named structs
+/// are those of the module. Each string is parsed once. Returns nullptr if
+/// the type can not be parsed
+llvm::Type* TokenSnapshot::getType(uint32_t Id) {
+    if (Id >= Head->NumStrings) return nullptr;
+    if (BoundTypes[Id]) return BoundTypes[Id];
+    if (!HasSlots) {
+        for (llvm::StructType* Struct : M.getIdentifiedStructTypes())
+            if (Struct->hasName())
+                Slots.NamedTypes[Struct->getName()] = Struct;
+        HasSlots = true;
+    }
+    llvm::SMDiagnostic Err;
+    return BoundTypes[Id] = llvm::parseType(getString(Id), Err, M, &Slots);
+}
+
+/// getToken - Returns the token with id \p ID when the snapshot was written,
+/// the token is added to the bank on the first request and gets an id of the
+/// bank. Returns nullptr for tokens which can not be bound to the module
+Alias* TokenSnapshot::getToken(uint32_t ID) {
+    assert(ID < size() && "Token id is not from this snapshot");
+    if (Bound[ID]) return Bound[ID];
+    const TokenRecord& Record = Records[ID];
+    if (!(Record.Flags & Bindable)) return nullptr;
+    if (Record.Field != None && Record.Field >= Head->NumFields)
+        return nullptr;
+    llvm::Function* F = getFunction(Record.Func);
+    if (Record.Func != None && !F) return nullptr;
+
+    auto bind = [&](Alias Base) {
+        return Bound[ID] = Bank.bindToken(Base, getField(Record.Field));
+    };
+    switch (static_cast<AliasKind>(Record.Kind)) {
+        case AliasKind::Value: {
+            if (!F) {
+                llvm::GlobalValue* Global =
+                    M.getNamedValue(getString(Record.Entity));
+                return Global ? bind(Alias(Global)) : nullptr;
+            }
+            auto Inserted = FunctionInsts.try_emplace(F);
+            std::vector<llvm::Instruction*>& Insts = Inserted.first->second;
+            if (Inserted.second)
+                for (llvm::Instruction& Inst : llvm::instructions(F))
+                    Insts.push_back(&Inst);
+            if (Record.Entity >= Insts.size()) return nullptr;
+            return bind(Alias(Insts[Record.Entity]));
+        }
+        case AliasKind::Argument:
+            if (!F || Record.Entity >= F->arg_size()) return nullptr;
+            return bind(Alias(F->getArg(Record.Entity)));
+        case AliasKind::Type: {
+            llvm::Type* Ty = getType(Record.Entity);
+            return Ty ? bind(Alias(Ty)) : nullptr;
+        }
+        case AliasKind::Dummy:
+            return bind(Alias(getString(Record.Entity).str(), F));
+        case AliasKind::Orig: {
+            // The base of an orig token has a smaller id
+            if (Record.Entity >= ID) return nullptr;
+            Alias* Base = getToken(Record.Entity);
+            if (!Base || Base->isOrig()) return nullptr;
+            return bind(Alias(Bank.getOrig(Base)));
+        }
+        case AliasKind::Heap:
+            return nullptr;
+    }
+    return nullptr;
+}
+
+}  // namespace AliasUtil
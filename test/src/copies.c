@@ -0,0 +1,19 @@
+struct S {
+    int *p, *q;
+};
+
+int *pick(int c, int *x, int *y) {
+    return c ? x : y;
+}
+
+int main(){
+    int a, b;
+    int *p = &a, *q;
+    struct S s = {&a, &b}, t;
+    t = s;
+    q = pick(a, p, &b);
+    __atomic_exchange_n(&q, p, __ATOMIC_SEQ_CST);
+    __atomic_compare_exchange_n(&p, &q, &b, 0, __ATOMIC_SEQ_CST,
+                                __ATOMIC_SEQ_CST);
+    return t.p == q;
+}
@@ -0,0 +1,66 @@
+#include "AliasSet.h"
+#include "AliasToken.h"
+#include "TestModules.h"
+#include "gtest/gtest.h"
+#include "algorithm"
+#include "set"
+
+using namespace llvm;
+using namespace AliasUtil;
+
+namespace {
+
+class AliasSetTest : public InputModuleTest {
+   protected:
+    static bool equals(const AliasSet& Set, const std::set<Alias*>& Ref) {
+        return Set.size() == Ref.size() &&
+               std::equal(Set.begin(), Set.end(), Ref.begin());
+    }
+};
+
+// Sets of tokens agree with std::set in both representations
+TEST_P(AliasSetTest, Operations) {
+    AliasTokens AT;
+    extractAll(AT, *M);
+    AliasSet Even(AT), Thirds(AT);
+    std::set<Alias*> EvenRef, ThirdsRef;
+    for (Alias* A : AT.tokens()) {
+        if (A->getID() % 2 == 0) {
+            Even.insert(A);
+            EvenRef.insert(A);
+        }
+        if (A->getID() % 3 == 0) {
+            Thirds.insert(A);
+            ThirdsRef.insert(A);
+        }
+    }
+    EXPECT_TRUE(equals(Even, EvenRef));
+    EXPECT_TRUE(equals(Thirds, ThirdsRef));
+
+    AliasSet Union = Even, Both = Even, Diff = Even;
+    std::set<Alias*> UnionRef = EvenRef, BothRef, DiffRef;
+    UnionRef.insert(ThirdsRef.begin(), ThirdsRef.end());
+    for (Alias* A : EvenRef) (ThirdsRef.count(A) ? BothRef : DiffRef).insert(A);
+    Union.unionWith(Thirds);
+    Both.intersectWith(Thirds);
+    Diff.subtract(Thirds);
+    EXPECT_TRUE(equals(Union, UnionRef));
+    EXPECT_TRUE(equals(Both, BothRef));
+    EXPECT_TRUE(equals(Diff, DiffRef));
+
+    // A fixed point does not change
+    EXPECT_FALSE(Union.unionWith(Thirds));
+    EXPECT_FALSE(Both.intersectWith(Thirds));
+    EXPECT_FALSE(Diff.subtract(Thirds));
+
+    // Equal sets are interned once
+    AliasSetPool Pool;
+    AliasSet Copy(AT);
+    for (Alias* A : Both) Copy.insert(A);
+    EXPECT_EQ(Pool.intern(Both), Pool.intern(Copy));
+    EXPECT_EQ(Pool.size(), 1u);
+}
+
+INSTANTIATE_TEST_SUITE_P(Inputs, AliasSetTest, ::testing::ValuesIn(Inputs));
+
+}  // namespace
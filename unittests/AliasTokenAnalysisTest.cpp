@@ -0,0 +1,29 @@
+#include "AliasTokenAnalysis.h"
+#include "TestModules.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/PassInstrumentation.h"
+#include "gtest/gtest.h"
+
+using namespace llvm;
+using namespace AliasUtil;
+
+namespace {
+
+class AliasTokenAnalysisTest : public InputModuleTest {};
+
+// The shared bank holds the tokens of the module
+TEST_P(AliasTokenAnalysisTest, SharedBank) {
+    ModuleAnalysisManager MAM;
+    MAM.registerPass([] { return PassInstrumentationAnalysis(); });
+    MAM.registerPass([] { return AliasTokenAnalysis(); });
+    AliasTokenResult& Shared = MAM.getResult<AliasTokenAnalysis>(*M);
+    AliasTokens AT;
+    for (Function& F : M->functions())
+        for (Instruction& I : instructions(F))
+            EXPECT_EQ(Shared.get(&I).size(), AT.extractAliasToken(&I).size());
+}
+
+INSTANTIATE_TEST_SUITE_P(Inputs, AliasTokenAnalysisTest,
+                         ::testing::ValuesIn(Inputs));
+
+}  // namespace
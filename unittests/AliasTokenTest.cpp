@@ -0,0 +1,449 @@
+#include "AliasToken.h"
+#include "TestModules.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/Support/JSON.h"
+#include "gtest/gtest.h"
+#include "algorithm"
+#include "map"
+#include "thread"
+
+using namespace llvm;
+using namespace AliasUtil;
+
+namespace {
+
+static_assert(StatementTraits<StoreInst>::LHSLevel == 2 &&
+                  StatementTraits<StoreInst>::RHSLevel == 1,
+              "Store statements should be *x = y");
+static_assert(StatementTraits<LoadInst>::LHSLevel == 1 &&
+                  StatementTraits<LoadInst>::RHSLevel == 2,
+              "Load statements should be x = *y");
+
+class AliasTokenModuleTest : public InputModuleTest {};
+
+// Every instruction gives one statement per RHS token, or one statement
+// without RHS, with the levels of extraction
+TEST_P(AliasTokenModuleTest, Statements) {
+    AliasTokens AT;
+    for (Function& F : M->functions()) {
+        auto Stmts = AT.statements(F);
+        auto Stmt = Stmts.begin();
+        for (Instruction& I : instructions(F)) {
+            if (!AliasTokens::isSupported(&I)) continue;
+            auto AliasVec = AT.extractAliasToken(&I);
+            if (AliasVec.empty()) continue;
+            for (size_t RHS = 1; RHS < std::max<size_t>(AliasVec.size(), 2);
+                 ++RHS, ++Stmt) {
+                ASSERT_TRUE(Stmt != Stmts.end());
+                EXPECT_EQ(Stmt->Inst, &I);
+                EXPECT_EQ(Stmt->LHS, AliasVec[0]);
+                EXPECT_EQ(Stmt->RHS,
+                          RHS < AliasVec.size() ? AliasVec[RHS] : nullptr);
+                EXPECT_EQ(std::make_pair(Stmt->LHSLevel, Stmt->RHSLevel),
+                          AT.extractTokens(&I).getStatementType());
+            }
+        }
+        EXPECT_TRUE(Stmt == Stmts.end());
+
+        // The callback form sees the statements of the range
+        Stmt = Stmts.begin();
+        AT.forEachStatement(F, [&](const Statement& S) {
+            ASSERT_TRUE(Stmt != Stmts.end());
+            EXPECT_EQ(S.Inst, Stmt->Inst);
+            EXPECT_EQ(S.LHS, Stmt->LHS);
+            EXPECT_EQ(S.RHS, Stmt->RHS);
+            EXPECT_EQ(S.LHSLevel, Stmt->LHSLevel);
+            EXPECT_EQ(S.RHSLevel, Stmt->RHSLevel);
+            ++Stmt;
+        });
+        EXPECT_TRUE(Stmt == Stmts.end());
+    }
+}
+
+// The location of an alloca is its orig token, never a dummy token
+TEST_P(AliasTokenModuleTest, Orig) {
+    AliasTokens AT;
+    for (Function& F : M->functions())
+        for (Instruction& I : instructions(F)) {
+            AllocaInst* Alloca = dyn_cast<AllocaInst>(&I);
+            if (!Alloca) continue;
+            auto AliasVec = AT.extractAliasToken(Alloca);
+            EXPECT_TRUE(AliasVec[1]->isOrig());
+            EXPECT_EQ(AliasVec[1]->getBase(), AliasVec[0]);
+            EXPECT_EQ(AT.getOrig(AliasVec[0]), AliasVec[1]);
+            EXPECT_NE(AT.getAliasToken(Alloca->getName().str() + "-orig", &F),
+                      AliasVec[1]);
+        }
+}
+
+// Type names are printed once per bank
+TEST_P(AliasTokenModuleTest, TypeNames) {
+    AliasTokens AT;
+    extractAll(AT, *M);
+    for (Alias* A : AT.tokens())
+        if (A->isMem()) {
+            EXPECT_EQ(AT.getMemTypeName(A), A->getMemTypeName());
+            EXPECT_EQ(AT.getMemTypeName(A).data(),
+                      AT.getMemTypeName(A).data());
+        }
+}
+
+TEST_P(AliasTokenModuleTest, DumpStats) {
+    AliasTokens AT;
+    extractAll(AT, *M);
+    std::string Stats;
+    raw_string_ostream OS(Stats);
+    AT.dumpStats(OS, /* JSON = */ true);
+    json::Value Parsed = cantFail(json::parse(OS.str()));
+    EXPECT_EQ(Parsed.getAsObject()->getInteger("tokens"), int64_t(AT.size()));
+}
+
+// Tokens local to a function are freed with it, shared tokens stay
+TEST_P(AliasTokenModuleTest, ReleaseFunction) {
+    AliasTokens AT(BankFlags::FunctionScoped);
+    for (GlobalVariable& G : M->globals()) AT.extractAliasToken(&G);
+    extractAll(AT, *M);
+    std::map<const Function*, std::vector<uint32_t>> Owned;
+    std::vector<Alias*> Shared;
+    for (Alias* A : AT.tokens()) {
+        const Function* Owner = nullptr;
+        for (Function& F : M->functions())
+            if (A->sameFunc(&F)) Owner = &F;
+        if (Owner)
+            Owned[Owner].push_back(A->getID());
+        else
+            Shared.push_back(A);
+    }
+    ASSERT_FALSE(Owned.empty());
+    size_t Remaining = AT.size();
+    for (Function& F : M->functions()) {
+        const std::vector<uint32_t>& IDs = Owned[&F];
+        EXPECT_EQ(AT.releaseFunction(&F), IDs.size());
+        Remaining -= IDs.size();
+        EXPECT_EQ(AT.size(), Remaining);
+        for (uint32_t ID : IDs) EXPECT_EQ(AT.lookup(ID), nullptr);
+    }
+    EXPECT_EQ(AT.size(), Shared.size());
+    for (Alias* A : Shared) EXPECT_EQ(AT.lookup(A->getID()), A);
+}
+
+// Threads sharing a concurrent bank get the same token for an entity
+TEST_P(AliasTokenModuleTest, Concurrent) {
+    std::vector<Instruction*> Insts;
+    for (Function& F : M->functions())
+        for (Instruction& I : instructions(F)) Insts.push_back(&I);
+    AliasTokens AT(BankFlags::Concurrent);
+    const unsigned NumThreads = 8;
+    std::vector<std::vector<std::vector<Alias*>>> Seen(NumThreads);
+    std::vector<std::thread> Threads;
+    for (unsigned T = 0; T < NumThreads; ++T)
+        Threads.emplace_back([&AT, &Insts, &Seen, T]() {
+            // Each thread starts at another instruction so that they race
+            // on the first request of the tokens
+            Seen[T].resize(Insts.size());
+            size_t Start = T * Insts.size() / NumThreads;
+            for (size_t I = 0; I < Insts.size(); ++I) {
+                size_t Index = (Start + I) % Insts.size();
+                Seen[T][Index] = AT.extractAliasToken(Insts[Index]);
+            }
+        });
+    for (std::thread& Thread : Threads) Thread.join();
+    for (unsigned T = 1; T < NumThreads; ++T) EXPECT_EQ(Seen[T], Seen[0]);
+    for (size_t I = 0; I < Insts.size(); ++I)
+        EXPECT_EQ(Seen[0][I], AT.extractAliasToken(Insts[I]));
+}
+
+// A concurrent tracking bank creates its value handles from several threads,
+// for tokens, cached results and allocation sites
+TEST_P(AliasTokenModuleTest, ConcurrentTracking) {
+    std::vector<Instruction*> Insts;
+    for (Function& F : M->functions())
+        for (Instruction& I : instructions(F)) Insts.push_back(&I);
+    AliasTokens AT(BankFlags::Concurrent | BankFlags::Tracking);
+    AT.setHeapAbstraction(HeapAbstraction::Site);
+    const unsigned NumThreads = 8;
+    std::vector<std::vector<ArrayRef<Alias*>>> Seen(NumThreads);
+    std::vector<std::thread> Threads;
+    for (unsigned T = 0; T < NumThreads; ++T)
+        Threads.emplace_back([&AT, &Insts, &Seen, T]() {
+            Seen[T].resize(Insts.size());
+            size_t Start = T * Insts.size() / NumThreads;
+            for (size_t I = 0; I < Insts.size(); ++I) {
+                size_t Index = (Start + I) % Insts.size();
+                Seen[T][Index] = AT.extractCachedAliasToken(Insts[Index]);
+                if (CallBase* Call = dyn_cast<CallBase>(Insts[Index]))
+                    AT.getAllocationToken(Call);
+            }
+        });
+    for (std::thread& Thread : Threads) Thread.join();
+    for (unsigned T = 1; T < NumThreads; ++T)
+        for (size_t I = 0; I < Insts.size(); ++I)
+            EXPECT_EQ(Seen[T][I].vec(), Seen[0][I].vec());
+    for (size_t I = 0; I < Insts.size(); ++I)
+        EXPECT_EQ(Seen[0][I].vec(), AT.extractAliasToken(Insts[I]));
+}
+
+// The table of a module holds the tokens extracted for each entity
+TEST_P(AliasTokenModuleTest, ExtractModule) {
+    AliasTokens AT(BankFlags::Concurrent);
+    ModuleTokens Table = AT.extractModule(*M, /* Threads = */ 4);
+    for (GlobalVariable& G : M->globals()) {
+        EXPECT_TRUE(Table.contains(&G));
+        EXPECT_EQ(Table.get(&G).vec(), AT.extractAliasToken(&G));
+    }
+    for (Function& F : M->functions()) {
+        if (F.isDeclaration()) continue;
+        for (Argument& Arg : F.args()) {
+            EXPECT_TRUE(Table.contains(&Arg));
+            EXPECT_EQ(Table.get(&Arg).vec(), AT.extractAliasToken(&Arg, &F));
+        }
+        for (Instruction& I : instructions(F)) {
+            EXPECT_TRUE(Table.contains(&I));
+            EXPECT_EQ(Table.get(&I).vec(), AT.extractAliasToken(&I));
+        }
+    }
+}
+
+// Cached extraction gives the tokens of extraction, once per instruction
+TEST_P(AliasTokenModuleTest, ExtractionCache) {
+    AliasTokens AT;
+    for (Function& F : M->functions())
+        for (Instruction& I : instructions(F)) {
+            ArrayRef<Alias*> Cached = AT.extractCachedAliasToken(&I);
+            EXPECT_EQ(Cached.vec(), AT.extractAliasToken(&I));
+            EXPECT_EQ(AT.extractCachedAliasToken(&I).data(), Cached.data());
+        }
+}
+
+INSTANTIATE_TEST_SUITE_P(Inputs, AliasTokenModuleTest,
+                         ::testing::ValuesIn(Inputs));
+
+// Cached tokens of deleted and replaced values are dropped
+TEST(AliasTokenTest, ExtractionCacheInvalidation) {
+    LLVMContext Ctx;
+    Module Scratch("scratch", Ctx);
+    Function* F =
+        Function::Create(FunctionType::get(Type::getVoidTy(Ctx), false),
+                         GlobalValue::ExternalLinkage, "f", Scratch);
+    IRBuilder<> Builder(BasicBlock::Create(Ctx, "entry", F));
+    Type* Ptr = Builder.getInt32Ty()->getPointerTo();
+    AllocaInst* X = Builder.CreateAlloca(Ptr, nullptr, "x");
+    AllocaInst* Y = Builder.CreateAlloca(Ptr, nullptr, "y");
+    LoadInst* L = Builder.CreateLoad(Ptr, X, "l");
+    Builder.CreateRetVoid();
+    AliasTokens AT;
+    EXPECT_EQ(AT.extractCachedAliasToken(L)[1], AT.getAliasToken(X));
+    X->replaceAllUsesWith(Y);
+    EXPECT_EQ(AT.extractCachedAliasToken(L)[1], AT.getAliasToken(Y));
+
+    // Replacing the cached instruction itself drops its results. The operand
+    // is changed with setOperand first, which the cache does not watch, so
+    // only the dropped results give the new pointer
+    L->setOperand(0, X);
+    L->replaceAllUsesWith(UndefValue::get(Ptr));
+    EXPECT_EQ(AT.extractCachedAliasToken(L)[1], AT.getAliasToken(X));
+
+    // Deleting the cached instruction drops its results too, so a load
+    // allocated at its address must not get them. Loads are allocated until
+    // the allocator hands the address out again
+    L->setOperand(0, Y);
+    EXPECT_EQ(AT.extractCachedAliasToken(L)[1], AT.getAliasToken(Y));
+    Instruction* Old = L;
+    L->eraseFromParent();
+    Instruction* Ret = F->getEntryBlock().getTerminator();
+    LoadInst* New = nullptr;
+    for (unsigned Attempt = 0; Attempt < 1024 && New != Old; ++Attempt)
+        New = new LoadInst(Ptr, X, "n", Ret);
+    ASSERT_EQ(New, Old);
+    EXPECT_EQ(AT.extractCachedAliasToken(New)[1], AT.getAliasToken(X));
+}
+
+// Dummy tokens of one name share the interned name across banks
+TEST(AliasTokenTest, DummyNames) {
+    LLVMContext Ctx;
+    Module Scratch("scratch", Ctx);
+    Function* F =
+        Function::Create(FunctionType::get(Type::getVoidTy(Ctx), false),
+                         GlobalValue::ExternalLinkage, "f", Scratch);
+    AliasTokens First, Second;
+    Alias* A = First.getAliasToken("dummy", F);
+    Alias* B = Second.getAliasToken("dummy", F);
+    EXPECT_EQ(A->getName(), "dummy");
+    EXPECT_EQ(A->getName().data(), B->getName().data());
+    EXPECT_EQ(*A, *B);
+    EXPECT_EQ(First.getAliasToken("", F)->getName(), "");
+}
+
+// Tokens of a tracking bank follow the values they are derived from
+TEST(AliasTokenTest, Tracking) {
+    LLVMContext Ctx;
+    Module Scratch("scratch", Ctx);
+    Function* F =
+        Function::Create(FunctionType::get(Type::getVoidTy(Ctx), false),
+                         GlobalValue::ExternalLinkage, "f", Scratch);
+    IRBuilder<> Builder(BasicBlock::Create(Ctx, "entry", F));
+    Type* Int = Builder.getInt32Ty();
+    AllocaInst* X = Builder.CreateAlloca(Int, nullptr, "x");
+    AllocaInst* Y = Builder.CreateAlloca(Int, nullptr, "y");
+    Builder.CreateRetVoid();
+    AliasTokens AT(BankFlags::Tracking);
+    auto AliasVec = AT.extractAliasToken(X);
+    AT.getAliasToken("d", F);
+    uint32_t XID = AliasVec[0]->getID();
+    X->replaceAllUsesWith(Y);
+    EXPECT_EQ(AliasVec[0]->getValue(), Y);
+    EXPECT_EQ(AT.getAliasToken(Y), AliasVec[0]);
+    EXPECT_EQ(AT.getOrig(AliasVec[0]), AliasVec[1]);
+
+    // Tokens of deleted values are evicted and compaction renumbers the
+    // remaining ones
+    X->eraseFromParent();
+    Y->eraseFromParent();
+    EXPECT_EQ(AT.size(), 1u);
+    EXPECT_EQ(AT.lookup(XID), nullptr);
+    EXPECT_EQ(AT.compact(), 2u);
+    ASSERT_EQ(AT.tokens().size(), 1u);
+    EXPECT_EQ(AT.tokens()[0]->getID(), 0u);
+
+    // Tokens replaced with a detached value are evicted
+    AllocaInst* W = new AllocaInst(Int, 0, "w", &F->getEntryBlock().front());
+    uint32_t WID = AT.extractAliasToken(W)[0]->getID();
+    Instruction* Detached = W->clone();
+    W->replaceAllUsesWith(Detached);
+    EXPECT_EQ(AT.lookup(WID), nullptr);
+    EXPECT_EQ(AT.size(), 1u);
+    W->eraseFromParent();
+    Detached->deleteValue();
+
+    // Dummy tokens go with their function
+    F->eraseFromParent();
+    EXPECT_EQ(AT.size(), 0u);
+}
+
+// Merged banks share the tokens of linked globals only
+TEST(AliasTokenTest, Merge) {
+    LLVMContext Ctx;
+    std::unique_ptr<Module> Def = parseModule(
+        "@g = global i32 0\n"
+        "define void @f() {\n  %x = alloca i32\n  ret void\n}\n",
+        Ctx);
+    std::unique_ptr<Module> Decl = parseModule(
+        "@g = external global i32\n"
+        "define void @f() {\n  %x = alloca i32\n  ret void\n}\n",
+        Ctx);
+    AliasTokens DefBank, DeclBank;
+    DefBank.extractModule(*Def);
+    DeclBank.extractModule(*Decl);
+    AliasTokens Merged(BankFlags::Concurrent);
+    auto Remaps = Merged.merge({&DefBank, &DeclBank}, /* Threads = */ 2);
+    Alias* DefG = DefBank.getAliasToken(Def->getNamedValue("g"));
+    Alias* DeclG = DeclBank.getAliasToken(Decl->getNamedValue("g"));
+    EXPECT_EQ(Remaps[0][DefG->getID()], Remaps[1][DeclG->getID()]);
+    EXPECT_EQ(Remaps[0][DefG->getID()]->getValue(), DefG->getValue());
+    EXPECT_EQ(Merged.getOrig(Remaps[0][DefG->getID()]),
+              Remaps[1][DeclBank.getOrig(DeclG)->getID()]);
+    EXPECT_EQ(Merged.size(), DefBank.size() + DeclBank.size() - 2);
+}
+
+// Heap tokens follow the abstraction of the bank and its cap
+TEST(AliasTokenTest, Heap) {
+    LLVMContext Ctx;
+    std::unique_ptr<Module> M = parseModule(
+        "declare i8* @malloc(i64)\n"
+        "define i32* @alloc() {\n"
+        "  %m = call i8* @malloc(i64 4)\n"
+        "  %p = bitcast i8* %m to i32*\n"
+        "  ret i32* %p\n}\n"
+        "define void @main() {\n"
+        "  %a = call i32* @alloc()\n"
+        "  %b = call i32* @alloc()\n"
+        "  %x = call i8* @malloc(i64 4)\n"
+        "  %y = call i8* @malloc(i64 4)\n"
+        "  ret void\n}\n",
+        Ctx);
+    ASSERT_TRUE(M);
+    Function* Main = M->getFunction("main");
+    Instruction* Cast = &*std::next(inst_begin(M->getFunction("alloc")));
+    CallBase* Site = cast<CallBase>(Cast->getOperand(0));
+    std::vector<CallBase*> Calls;
+    for (Instruction& I : instructions(Main))
+        if (CallBase* Call = dyn_cast<CallBase>(&I)) Calls.push_back(Call);
+    Type* IntPtr = Cast->getType();
+    Type* BytePtr = Site->getType();
+
+    // Heap tokens are shared by a type, extraction only gives the type of
+    // operator new like the baseline and no heap token on the call
+    AliasTokens Types;
+    Types.setHeapAbstraction(HeapAbstraction::Type);
+    EXPECT_EQ(Types.extractTokens(Cast)[1], Types.getAliasToken(Site));
+    EXPECT_EQ(Types.extractTokens(Calls[2]).size(), 1u);
+    EXPECT_EQ(Types.getAllocationToken(Site), Types.getAliasToken(IntPtr));
+    EXPECT_EQ(Types.getAllocationToken(Calls[2]),
+              Types.getAllocationToken(Calls[3]));
+    EXPECT_EQ(Types.getAllocationToken(Calls[2]),
+              Types.getAliasToken(BytePtr));
+    EXPECT_EQ(Types.getAllocationToken(Calls[0]), nullptr);
+
+    // Heap tokens are distinct per site, without the calling context
+    AliasTokens Sites;
+    Sites.setHeapAbstraction(HeapAbstraction::Site);
+    Alias* X = Sites.getAllocationToken(Calls[2]);
+    EXPECT_TRUE(X->isHeap());
+    EXPECT_TRUE(X->isMem());
+    EXPECT_NE(X, Sites.getAllocationToken(Calls[3]));
+    EXPECT_EQ(Sites.getMemTypeName(X), X->getMemTypeName());
+    EXPECT_EQ(Sites.extractTokens(Cast)[1],
+              Sites.getHeapToken(Site, IntPtr, {Calls[0]}));
+    EXPECT_EQ(Sites.getAllocationToken(Site), Sites.extractTokens(Cast)[1]);
+
+    // Call strings are limited to K call sites
+    AliasTokens Strings;
+    Strings.setHeapAbstraction(HeapAbstraction::CallString, 1);
+    Alias* A = Strings.getHeapToken(Site, IntPtr, {Calls[0]});
+    EXPECT_NE(A, Strings.getHeapToken(Site, IntPtr, {Calls[1]}));
+    EXPECT_EQ(A, Strings.getHeapToken(Site, IntPtr, {Calls[0], Calls[1]}));
+    EXPECT_EQ(A->getHeapContext()->getDepth(), 1u);
+    EXPECT_EQ(A->getHeapContext()->getAllocation(),
+              Strings.extractTokens(Cast)[1]->getHeapContext());
+
+    // Capped heap tokens fall back to coarser tokens
+    AliasTokens Capped;
+    Capped.setHeapAbstraction(HeapAbstraction::CallString, 1, 2);
+    Alias* Context = Capped.getHeapToken(Site, IntPtr, {Calls[0]});
+    Alias* Alone = Capped.getHeapToken(Site, IntPtr);
+    EXPECT_EQ(Capped.getHeapToken(Site, IntPtr, {Calls[1]}), Alone);
+    EXPECT_EQ(Capped.getHeapToken(Site, IntPtr, {Calls[0]}), Context);
+    EXPECT_EQ(Capped.getAllocationToken(Calls[2]),
+              Capped.getAliasToken(BytePtr));
+
+    // Contexts through a released function are evicted
+    AliasTokens Scoped(BankFlags::FunctionScoped);
+    Scoped.setHeapAbstraction(HeapAbstraction::CallString, 1);
+    Alias* Released = Scoped.getHeapToken(Site, IntPtr, {Calls[0]});
+    Alias* Kept = Scoped.getHeapToken(Site, IntPtr);
+    uint32_t ReleasedID = Released->getID();
+    EXPECT_GE(Scoped.releaseFunction(Main), 1u);
+    EXPECT_EQ(Scoped.lookup(ReleasedID), nullptr);
+    EXPECT_EQ(Scoped.lookup(Kept->getID()), Kept);
+
+    // Contexts through a deleted site or of a deleted allocation are evicted
+    AliasTokens Tracked(BankFlags::Tracking);
+    Tracked.setHeapAbstraction(HeapAbstraction::CallString, 1);
+    Alias* First = Tracked.getHeapToken(Site, IntPtr, {Calls[0]});
+    Alias* Second = Tracked.getHeapToken(Site, IntPtr, {Calls[1]});
+    uint32_t FirstID = First->getID();
+    uint32_t AllocID = Tracked.getAllocationToken(Calls[2])->getID();
+    Calls[0]->eraseFromParent();
+    Calls[2]->eraseFromParent();
+    EXPECT_EQ(Tracked.lookup(FirstID), nullptr);
+    EXPECT_EQ(Tracked.lookup(AllocID), nullptr);
+    EXPECT_EQ(Tracked.lookup(Second->getID()), Second);
+    uint32_t SecondID = Second->getID();
+    Cast->replaceAllUsesWith(UndefValue::get(IntPtr));
+    Cast->eraseFromParent();
+    Site->eraseFromParent();
+    EXPECT_EQ(Tracked.lookup(SecondID), nullptr);
+}
+
+}  // namespace
@@ -0,0 +1,46 @@
+#include "AliasToken.h"
+#include "CallBindings.h"
+#include "TestModules.h"
+#include "gtest/gtest.h"
+
+using namespace llvm;
+using namespace AliasUtil;
+
+namespace {
+
+// Call sites bind actuals to formals and returned values to results
+TEST(CallBindingsTest, Bindings) {
+    LLVMContext Ctx;
+    std::unique_ptr<Module> M = parseModule(
+        "define i32* @id(i32* %p) {\n  ret i32* %p\n}\n"
+        "define void @main(i32* (i32*)* %fp) {\n"
+        "  %x = alloca i32\n"
+        "  %r = call i32* @id(i32* %x)\n"
+        "  %s = call i32* %fp(i32* %x)\n"
+        "  ret void\n}\n",
+        Ctx);
+    ASSERT_TRUE(M);
+    Function* Id = M->getFunction("id");
+    AliasTokens AT;
+    CallBindings Direct = AT.bindCalls(*M);
+    CallBindings Resolved = AT.bindCalls(
+        *M, [Id](CallBase*, SmallVectorImpl<Function*>& Callees) {
+            Callees.push_back(Id);
+        });
+    // Indirect calls are bound through the resolver
+    EXPECT_EQ(Direct.size(), 1u);
+    EXPECT_EQ(Resolved.size(), 2u);
+    for (const CallBindings::Site& S : Resolved.sites()) {
+        auto Args = Resolved.getArguments(S);
+        auto Rets = Resolved.getReturns(S);
+        EXPECT_EQ(S.Callee, Id);
+        ASSERT_EQ(Args.size(), 1u);
+        EXPECT_EQ(Args[0].Source, AT.getAliasToken(S.Call->getArgOperand(0)));
+        EXPECT_EQ(Args[0].Target, AT.getAliasToken(Id->getArg(0)));
+        ASSERT_EQ(Rets.size(), 1u);
+        EXPECT_EQ(Rets[0].Source, Args[0].Target);
+        EXPECT_EQ(Rets[0].Target, AT.getAliasToken(S.Call));
+    }
+}
+
+}  // namespace
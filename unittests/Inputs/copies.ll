@@ -0,0 +1,28 @@
+%struct.S = type { i32*, i32* }
+declare void @llvm.memcpy.p0i8.p0i8.i64(i8*, i8*, i64, i1)
+define i32* @pick(i1 %c, i32* %x, i32* %y) {
+entry:
+  br i1 %c, label %a, label %b
+a:
+  br label %m
+b:
+  br label %m
+m:
+  %p = phi i32* [ %x, %a ], [ %y, %b ]
+  %s = select i1 %c, i32* %p, i32* null
+  %s2 = select i1 %c, i32* %p, i32* %y
+  %q = alloca i32*
+  %qi = bitcast i32** %q to i64*
+  %si = ptrtoint i32* %s to i64
+  %oldi = atomicrmw xchg i64* %qi, i64 %si seq_cst
+  %old = inttoptr i64 %oldi to i32*
+  %add = atomicrmw add i32* %x, i32 1 seq_cst
+  %cx = cmpxchg i32** %q, i32* %old, i32* %s2 seq_cst seq_cst
+  %s1 = alloca %struct.S
+  %s0 = alloca %struct.S
+  %d = bitcast %struct.S* %s1 to i8*
+  %e = bitcast %struct.S* %s0 to i8*
+  call void @llvm.memcpy.p0i8.p0i8.i64(i8* %d, i8* %e, i64 16, i1 false)
+  %cmp = icmp eq i32* %x, %y
+  ret i32* %s
+}
@@ -0,0 +1,26 @@
+%struct.S = type { i32, i32*, %struct.T }
+%struct.T = type { i32*, i32* }
+@g = global i32* null
+define i32 @main() {
+entry:
+  %retval = alloca i32
+  %a = alloca i32*
+  %b = alloca i32
+  %s = alloca %struct.S
+  store i32 0, i32* %retval
+  store i32* %b, i32** %a
+  %f = getelementptr inbounds %struct.S, %struct.S* %s, i32 0, i32 2, i32 1
+  %l = load i32*, i32** %a
+  store i32* %l, i32** %f
+  store i32* %b, i32** @g
+  %c = call i8* @_Znwm(i64 4)
+  %d = bitcast i8* %c to i32*
+  ret i32 0
+}
+define void @foo(i32* %p) {
+entry:
+  %p.addr = alloca i32*
+  store i32* %p, i32** %p.addr
+  ret void
+}
+declare i8* @_Znwm(i64)
@@ -0,0 +1,55 @@
+#ifndef ALIASTOKEN_UNITTESTS_TESTMODULES_H
+#define ALIASTOKEN_UNITTESTS_TESTMODULES_H
+
+#include "AliasToken.h"
+#include "llvm/AsmParser/Parser.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/raw_ostream.h"
+#include "gtest/gtest.h"
+#include "memory"
+#include "string"
+
+namespace AliasUtil {
+
+/// parseModule - Parses the textual IR \p IR, a test module is expected to
+/// be well formed
+inline std::unique_ptr<llvm::Module> parseModule(llvm::StringRef IR,
+                                                 llvm::LLVMContext& Ctx) {
+    llvm::SMDiagnostic Err;
+    std::unique_ptr<llvm::Module> M = llvm::parseAssemblyString(IR, Err, Ctx);
+    if (!M) Err.print("AliasTokenTests", llvm::errs());
+    return M;
+}
+
+/// extractAll - Extracts the tokens of every instruction of \p M into \p AT
+inline void extractAll(AliasTokens& AT, llvm::Module& M) {
+    for (llvm::Function& F : M.functions())
+        for (llvm::Instruction& I : llvm::instructions(F))
+            AT.extractAliasToken(&I);
+}
+
+/// InputModuleTest - Fixture of the tests checking properties which hold on
+/// any module, run once for each IR file of unittests/Inputs
+class InputModuleTest : public ::testing::TestWithParam<const char*> {
+   protected:
+    llvm::LLVMContext Ctx;
+    std::unique_ptr<llvm::Module> M;
+
+    void SetUp() override {
+        llvm::SMDiagnostic Err;
+        M = llvm::parseAssemblyFile(
+            std::string(ALIASTOKEN_TEST_INPUTS "/") + GetParam(), Err, Ctx);
+        if (!M) Err.print("AliasTokenTests", llvm::errs());
+        ASSERT_TRUE(M);
+    }
+};
+
+/// Inputs - IR files of unittests/Inputs
+static const char* const Inputs[] = {"stores.ll", "copies.ll"};
+
+}  // namespace AliasUtil
+
+#endif
@@ -0,0 +1,80 @@
+#include "AliasToken.h"
+#include "TestModules.h"
+#include "TokenSnapshot.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "gtest/gtest.h"
+
+using namespace llvm;
+using namespace AliasUtil;
+
+namespace {
+
+class TokenSnapshotTest : public InputModuleTest {};
+
+// Tokens read back from a snapshot denote the same entities
+TEST_P(TokenSnapshotTest, RoundTrip) {
+    AliasTokens AT;
+    extractAll(AT, *M);
+    for (GlobalVariable& G : M->globals()) AT.extractAliasToken(&G);
+    for (Function& F : M->functions())
+        for (Instruction& I : instructions(F))
+            if (GetElementPtrInst* GEP = dyn_cast<GetElementPtrInst>(&I))
+                AT.handleGEPUtil(GEP,
+                                 AT.getAliasToken(GEP->getPointerOperand()));
+    std::string Image;
+    raw_string_ostream OS(Image);
+    AT.serialize(OS, *M);
+    AliasTokens Warm;
+    auto Snapshot = cantFail(TokenSnapshot::load(
+        MemoryBuffer::getMemBuffer(OS.str(), "", false), *M, Warm));
+    EXPECT_EQ(Snapshot->size(), AT.tokens().size());
+    for (Alias* A : AT.tokens()) {
+        Alias* Bound = Snapshot->getToken(A->getID());
+        ASSERT_NE(Bound, nullptr);
+        EXPECT_EQ(Bound->getKind(), A->getKind());
+        EXPECT_EQ(Bound->getValue(), A->getValue());
+        EXPECT_EQ(Bound->getHash(), A->getHash());
+    }
+
+    // Images without the magic are rejected
+    Image[0] = '?';
+    auto Corrupt = TokenSnapshot::load(
+        MemoryBuffer::getMemBuffer(Image, "", false), *M, Warm);
+    EXPECT_FALSE(bool(Corrupt));
+    consumeError(Corrupt.takeError());
+}
+
+INSTANTIATE_TEST_SUITE_P(Inputs, TokenSnapshotTest,
+                         ::testing::ValuesIn(Inputs));
+
+// Heap and field tokens of named structs bind to the module's types
+TEST(TokenSnapshotStructTest, NamedStructs) {
+    LLVMContext Ctx;
+    std::unique_ptr<Module> Structs = parseModule(
+        "%struct.S = type { i32*, i32* }\n"
+        "define i32** @f(%struct.S* %s) {\n"
+        "  %p = getelementptr %struct.S, %struct.S* %s, i32 0, i32 1\n"
+        "  ret i32** %p\n}\n",
+        Ctx);
+    ASSERT_TRUE(Structs);
+    Type* StructPtr =
+        StructType::getTypeByName(Ctx, "struct.S")->getPointerTo();
+    AliasTokens Typed;
+    Alias* Heap = Typed.getAliasToken(StructPtr);
+    Instruction* GEP = &*inst_begin(Structs->getFunction("f"));
+    Alias* Field = Typed.handleGEPUtil(cast<GetElementPtrInst>(GEP), Heap);
+    std::string Image;
+    raw_string_ostream OS(Image);
+    Typed.serialize(OS, *Structs);
+    AliasTokens Warm;
+    auto Snapshot = cantFail(TokenSnapshot::load(
+        MemoryBuffer::getMemBuffer(OS.str(), "", false), *Structs, Warm));
+    EXPECT_EQ(Snapshot->getToken(Heap->getID()),
+              Warm.getAliasToken(StructPtr));
+    EXPECT_EQ(Snapshot->getToken(Field->getID())->getHash(),
+              Field->getHash());
+    EXPECT_EQ(StructType::getTypeByName(Ctx, "struct.S.0"), nullptr);
+}
+
+}  // namespace